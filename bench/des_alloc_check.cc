@@ -0,0 +1,112 @@
+#include <stdlib.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "des_cipher.h"
+#include "des_ctr.h"
+#include "des_key_bank.h"
+
+// Runs the per-message encrypt and decrypt paths under a counting
+// operator new and fails if any of them allocates. Everything a path needs
+// (tables, rings, output strings) is set up once before counting starts;
+// past that, a message must not touch the heap.
+
+// ----------------------------------------------------------------------------
+// count every heap allocation made by the process
+static std::atomic<size_t> allocations{0};
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+namespace {
+
+const size_t kMessages = 10000;
+const size_t kMaxMessage = 1500;
+
+// keeps results observable so the optimizer cannot drop the work
+volatile uint8_t sink;
+
+// ----------------------------------------------------------------------------
+// Run `body` once to warm it up, then once per message size, and report how
+// many allocations the counted runs made.
+template <typename Body>
+bool check(const char* name, Body body) {
+  body(kMaxMessage);
+
+  size_t before = allocations.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < kMessages; ++i)
+    body(1 + i % kMaxMessage);
+  size_t allocs = allocations.load(std::memory_order_relaxed) - before;
+
+  std::cout << (allocs == 0 ? "ok    " : "FAIL  ") << name;
+  if (allocs != 0)
+    std::cout << ": " << allocs << " allocations in " << kMessages << " messages";
+  std::cout << "\n";
+  return allocs == 0;
+}
+
+} // namespace
+
+// ============================================================================
+int main() {
+  DES::Cipher cipher(0x2A5);
+  DES::CipherHandle banked = DES::KeyBank::instance().cipher(0x2A5);
+  DES::CtrCipher ctr(cipher.handle(), 1);
+
+  std::vector<uint8_t> in(kMaxMessage, 'x'), out(kMaxMessage);
+  std::string text(kMaxMessage, 'x'), result;
+  result.reserve(kMaxMessage);
+
+  bool passed = true;
+  passed &= check("Cipher buffer", [&](size_t n) {
+    cipher.encrypt(in.data(), out.data(), n);
+    cipher.decrypt(out.data(), out.data(), n);
+    sink = out[n - 1];
+  });
+  passed &= check("Cipher in place", [&](size_t n) {
+    cipher.encrypt(in.data(), n);
+    cipher.decrypt(in.data(), n);
+    sink = in[n - 1];
+  });
+  passed &= check("Cipher string in place", [&](size_t n) {
+    text.resize(n, 'x');
+    cipher.encrypt(text);
+    cipher.decrypt(text);
+    sink = static_cast<uint8_t>(text[n - 1]);
+  });
+  passed &= check("Cipher string into reserved", [&](size_t n) {
+    text.resize(n, 'x');
+    cipher.encrypt(text, result);
+    cipher.decrypt(result, text);
+    sink = static_cast<uint8_t>(text[n - 1]);
+  });
+  passed &= check("KeyBank handle", [&](size_t n) {
+    banked.encrypt(in.data(), out.data(), n);
+    banked.decrypt(out.data(), n);
+    sink = out[n - 1];
+  });
+  passed &= check("CtrCipher", [&](size_t n) {
+    uint64_t counter = ctr.counter();
+    ctr.encrypt(in.data(), out.data(), n);
+    ctr.decryptAt(counter, out.data(), n);
+    ctr.prefetch();
+    sink = out[n - 1];
+  });
+
+  if (!passed) {
+    std::cerr << "ERROR: the hot path allocates\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
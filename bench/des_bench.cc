@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "des_bulk.h"
+#include "des_cipher.h"
+#include "des_ctr.h"
+#include "des_key_bank.h"
+#include "des_key_search.h"
+#include "des_parallel.h"
+
+// Micro-benchmarks for the DES module. Every case prints one JSON object per
+// line, so runs can be diffed or loaded by a script to track regressions:
+//
+//   {"bench":"string_encrypt","bytes":1024,"iterations":...,"ns_per_op":...,
+//    "ns_per_byte":...,"bytes_per_s":...,"allocs_per_op":...}
+
+// ----------------------------------------------------------------------------
+// count every heap allocation made by the process
+static std::atomic<size_t> allocations{0};
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+namespace {
+
+struct Settings {
+  size_t max_size = 64 << 20;
+  double min_time = 0.2;    // seconds per case
+  const char* filter = "";
+};
+
+Settings settings;
+
+// keeps results observable so the optimizer cannot drop the work
+volatile uint8_t sink;
+
+// ----------------------------------------------------------------------------
+// Run `body` in doubling batches until a batch takes min_time, then report
+// that batch. `bytes` is the payload per call, 0 for per-call cases.
+template <typename Body>
+void measure(const char* name, size_t bytes, Body body) {
+  if (!strstr(name, settings.filter))
+    return;
+
+  body();  // warm up tables, caches and output buffers
+
+  using namespace std::chrono;
+  size_t iterations = 1;
+  while (true) {
+    size_t allocs_before = allocations.load(std::memory_order_relaxed);
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+      body();
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    size_t allocs = allocations.load(std::memory_order_relaxed) - allocs_before;
+
+    if (seconds >= settings.min_time || iterations >= (size_t(1) << 34)) {
+      double ns_per_op = seconds * 1e9 / iterations;
+      printf("{\"bench\":\"%s\",\"bytes\":%zu,\"iterations\":%zu,"
+             "\"ns_per_op\":%.3f,\"ns_per_byte\":%.4f,\"bytes_per_s\":%.0f,"
+             "\"allocs_per_op\":%.3f}\n",
+             name, bytes, iterations, ns_per_op,
+             bytes ? ns_per_op / bytes : 0.0,
+             bytes ? bytes * iterations / seconds : 0.0,
+             static_cast<double>(allocs) / iterations);
+      fflush(stdout);
+      return;
+    }
+    iterations *= 2;
+  }
+}
+
+// ----------------------------------------------------------------------------
+std::vector<size_t> payload_sizes() {
+  // 16 B to 64 MB in steps of 4x
+  std::vector<size_t> sizes;
+  for (size_t size = 16; size <= settings.max_size; size *= 4)
+    sizes.push_back(size);
+  return sizes;
+}
+
+// ----------------------------------------------------------------------------
+std::string random_payload(size_t size) {
+  std::mt19937 rng(static_cast<unsigned>(size));
+  std::string payload(size, '\0');
+  for (char& c : payload)
+    c = static_cast<char>(rng());
+  return payload;
+}
+
+// ----------------------------------------------------------------------------
+void bench_setup() {
+  uint16_t key = 0;
+  measure("cipher_construct", 0, [&]() {
+    DES::Cipher cipher(key++ & 0x3FF);
+    sink = cipher.encrypt(uint8_t(0));
+  });
+  measure("generate_tables", 0, [&]() {
+    DES::Tables tables = DES::generateTables(key++ & 0x3FF);
+    sink = tables.encrypt[0];
+  });
+  measure("key_bank_handle", 0, [&]() {
+    DES::CipherHandle cipher = DES::KeyBank::instance().cipher(key++ & 0x3FF);
+    sink = cipher.encrypt(uint8_t(0));
+  });
+}
+
+// ----------------------------------------------------------------------------
+void bench_single_byte() {
+  DES::Cipher cipher(0x1A5);
+  uint8_t byte = 0;
+  measure("byte_encrypt", 1, [&]() { byte = cipher.encrypt(byte); });
+  measure("byte_decrypt", 1, [&]() { byte = cipher.decrypt(byte); });
+  sink = byte;
+}
+
+// ----------------------------------------------------------------------------
+void bench_strings() {
+  DES::Cipher cipher(0x1A5);
+  for (size_t size : payload_sizes()) {
+    std::string plain = random_payload(size);
+    std::string result;
+    measure("string_encrypt", size, [&]() { cipher.encrypt(plain, result); });
+    measure("string_decrypt", size, [&]() { cipher.decrypt(plain, result); });
+    measure("string_encrypt_in_place", size, [&]() { cipher.encrypt(plain); });
+    measure("fixed_string_encrypt", size, [&]() {
+      DES::DefaultCipher::encrypt(plain, result);
+    });
+  }
+}
+
+// ----------------------------------------------------------------------------
+void bench_kernels() {
+  const DES::Kernel kernels[] = {DES::Kernel::kScalar, DES::Kernel::kSSSE3,
+                                 DES::Kernel::kAVX2, DES::Kernel::kAVX512VBMI};
+  const DES::Tables& tables = DES::KeyBank::instance().tables(0x1A5);
+  for (DES::Kernel kernel : kernels) {
+    if (kernel > DES::activeKernel())
+      continue;
+
+    std::string name = std::string("kernel_") + DES::kernelName(kernel);
+    for (size_t size : payload_sizes()) {
+      std::string payload = random_payload(size);
+      uint8_t* data = reinterpret_cast<uint8_t*>(&payload[0]);
+      measure(name.c_str(), size, [&]() {
+        DES::substitute(kernel, tables.encrypt, data, data, size);
+      });
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+void bench_modes() {
+  DES::CipherHandle cipher = DES::KeyBank::instance().cipher(0x1A5);
+  DES::ParallelCipher parallel(cipher);
+  for (size_t size : payload_sizes()) {
+    std::string payload = random_payload(size);
+    std::string result;
+    uint8_t* data = reinterpret_cast<uint8_t*>(&payload[0]);
+
+    measure("parallel_encrypt", size, [&]() { parallel.encrypt(payload, result); });
+    measure("ctr_keystream", size, [&]() { DES::generateKeystream(cipher, 0, data, size); });
+
+    // the ring stays at its default size, so payloads larger than it pay
+    // for generating keystream inline
+    DES::CtrCipher ctr(cipher, 0);
+    measure("ctr_encrypt_prefetched", size, [&]() {
+      ctr.encrypt(data, data, size);
+      ctr.prefetch();
+    });
+  }
+}
+
+// ----------------------------------------------------------------------------
+void bench_key_search() {
+  DES::CipherHandle cipher = DES::KeyBank::instance().cipher(0x1A5);
+  uint8_t plain[8] = {'N', 'e', 'e', 'd', 'h', 'a', 'm', '!'};
+  uint8_t encrypted[8];
+  cipher.encrypt(plain, encrypted, sizeof plain);
+
+  // bytes here are keys searched per call
+  measure("key_search_64", 1024, [&]() {
+    sink = DES::searchKeys(plain, encrypted, sizeof plain, DES::SliceWidth::k64).size();
+  });
+  measure("key_search_256", 1024, [&]() {
+    sink = DES::searchKeys(plain, encrypted, sizeof plain, DES::SliceWidth::k256).size();
+  });
+}
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      std::cerr << "Invalid Argument(s).\n";
+      std::cerr << "USAGE: " << argv[0]
+                << " [--filter <name>] [--max-size <bytes>] [--min-time <seconds>]\n";
+      std::exit(EXIT_FAILURE);
+    }
+    if (strcmp(argv[i], "--filter") == 0)
+      settings.filter = argv[i + 1];
+    else if (strcmp(argv[i], "--max-size") == 0)
+      settings.max_size = std::stoul(argv[i + 1]);
+    else if (strcmp(argv[i], "--min-time") == 0)
+      settings.min_time = std::stod(argv[i + 1]);
+    else
+      validate_input(2, argv);  // prints usage and exits
+  }
+}
+
+} // namespace
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+  std::cerr << "DES benchmarks, kernel " << DES::kernelName(DES::activeKernel())
+            << ", pool of " << DES::WorkerPool::shared().size() + 1 << " threads\n";
+
+  bench_setup();
+  bench_single_byte();
+  bench_strings();
+  bench_kernels();
+  bench_modes();
+  bench_key_search();
+  return EXIT_SUCCESS;
+}
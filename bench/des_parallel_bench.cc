@@ -0,0 +1,73 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "des_key_bank.h"
+#include "des_parallel.h"
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  if (argc > 3) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " [<max-threads> [<megabytes>]]\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+  size_t max_threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+  size_t megabytes = argc > 2 ? std::stoul(argv[2]) : 256;
+  if (max_threads == 0)
+    max_threads = 1;
+
+  std::vector<uint8_t> plain(megabytes << 20), encrypted(plain.size());
+  std::mt19937 rng(24);
+  for (uint8_t& byte : plain)
+    byte = static_cast<uint8_t>(rng());
+
+  DES::CipherHandle cipher = DES::KeyBank::instance().cipher(0x2D7);
+  DES::ParallelOptions options;
+  options.threshold = 0;
+
+  std::cout << "Encrypting " << megabytes << " MB, " << options.chunk / 1024
+            << " KB chunks, kernel " << DES::kernelName(DES::activeKernel()) << "\n"
+            << "threads     MB/s  speedup\n";
+
+  double single = 0;
+  for (size_t threads = 1; threads <= max_threads; ++threads) {
+    // the calling thread is one of the workers
+    DES::WorkerPool pool(threads - 1);
+    DES::ParallelCipher parallel(cipher, pool, options);
+    parallel.encrypt(plain.data(), encrypted.data(), plain.size());  // warm up
+
+    using namespace std::chrono;
+    const int kRounds = 5;
+    steady_clock::time_point start = steady_clock::now();
+    for (int i = 0; i < kRounds; ++i)
+      parallel.encrypt(plain.data(), encrypted.data(), plain.size());
+    double seconds = duration<double>(steady_clock::now() - start).count();
+
+    double rate = kRounds * plain.size() / seconds / 1e6;
+    if (threads == 1)
+      single = rate;
+    std::cout << std::setw(7) << threads << std::fixed << std::setprecision(0)
+              << std::setw(9) << rate << std::setprecision(2)
+              << std::setw(9) << rate / single << "\n";
+  }
+
+  // make sure the chunks really covered the whole buffer
+  std::vector<uint8_t> expected(plain.size());
+  cipher.encrypt(plain.data(), expected.data(), plain.size());
+  if (expected != encrypted) {
+    std::cerr << "ERROR: parallel output differs from DES::CipherHandle\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
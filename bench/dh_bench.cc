@@ -0,0 +1,92 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dh_group.h"
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " <group-file>... (e.g. groups/ffdhe2048.txt)\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// run op for about a second and report what it managed
+template <typename Op>
+void report(const char* name, Op op) {
+  using namespace std::chrono;
+  long ops = 0;
+  steady_clock::time_point start = steady_clock::now();
+  double elapsed = 0;
+  while (elapsed < 1.0) {
+    op();
+    ++ops;
+    elapsed = duration<double>(steady_clock::now() - start).count();
+  }
+  std::cout << "  " << std::left << std::setw(34) << name << std::right << std::fixed
+            << std::setprecision(1) << std::setw(10) << elapsed / ops * 1e6
+            << std::setprecision(0) << std::setw(10) << ops / elapsed << "\n";
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+
+  for (int file = 1; file < argc; ++file) {
+    std::ifstream in(argv[file]);
+    std::string P_text, G_text;
+    DH::Number P, G;
+    if (!(in >> P_text >> G_text) || !DH::Number::parse(P_text, P) ||
+        !DH::Number::parse(G_text, G)) {
+      std::cerr << "ERROR: failed to read P and G from " << argv[file] << "\n";
+      return EXIT_FAILURE;
+    }
+
+    DH::Group group(P, G);
+    DH::Number x, y, peer_x, peer_y;
+    group.generate(x, y);
+    group.generate(peer_x, peer_y);
+
+    // a full-size exponent, the way groups without a short exponent are used
+    std::vector<uint64_t> limbs = P.limbs();
+    limbs.back() >>= 1;
+    DH::Number long_x(limbs);
+
+    std::cout << argv[file] << ": " << P.bits() << "-bit P, " << group.exponentBits()
+              << "-bit exponents, one core\n"
+              << "  operation                               us/op     ops/s\n";
+    report("y^x, sliding window", [&]() { group.pow(peer_y, x); });
+    report("y^x, full-size x", [&]() { group.pow(peer_y, long_x); });
+    report("G^x, sliding window", [&]() { group.publicValue(x); });
+
+    using namespace std::chrono;
+    steady_clock::time_point start = steady_clock::now();
+    group.precompute();
+    double build = duration<double>(steady_clock::now() - start).count();
+    report("G^x, fixed-base comb", [&]() { group.publicValue(x); });
+    std::cout << "  (comb built in " << std::fixed << std::setprecision(2) << build * 1e3
+              << " ms)\n";
+
+    // what the KDC does per client: a fresh exponent, G^x and the secret
+    report("KDC handshake", [&]() {
+      DH::Number exponent, value;
+      group.generate(exponent, value);
+      group.pow(peer_y, exponent);
+    });
+
+    // both ends must agree, and the comb must agree with plain powers
+    if (group.pow(peer_y, x) != group.pow(y, peer_x) ||
+        group.publicValue(x) != group.pow(G, x)) {
+      std::cerr << "ERROR: " << argv[file] << " computed inconsistent values\n";
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
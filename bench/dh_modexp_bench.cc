@@ -0,0 +1,112 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dh_modexp.h"
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  if (argc > 2) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " [<exponentiations>]\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// square-and-multiply with a 128-bit remainder every step, the reference
+uint64_t modexp_remainder(uint64_t base, uint64_t exponent, uint64_t modulus) {
+  uint64_t result = 1 % modulus;
+  base %= modulus;
+  for (; exponent != 0; exponent >>= 1) {
+    if (exponent & 1)
+      result = DH::mulmod(result, base, modulus);
+    base = DH::mulmod(base, base, modulus);
+  }
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+template <typename Run>
+void report(const char* name, size_t count, Run run) {
+  using namespace std::chrono;
+  steady_clock::time_point start = steady_clock::now();
+  run();
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+  std::cout << std::left << std::setw(28) << name << std::right << std::fixed
+            << std::setprecision(1) << std::setw(10) << elapsed / count * 1e9
+            << std::setprecision(0) << std::setw(14) << count / elapsed << "\n";
+}
+
+// ----------------------------------------------------------------------------
+size_t mismatches(const std::vector<uint64_t>& results, const std::vector<uint64_t>& expected) {
+  size_t wrong = 0;
+  for (size_t i = 0; i < results.size(); ++i)
+    wrong += results[i] != expected[i];
+  return wrong;
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+  size_t count = argc > 1 ? std::stoul(argv[1]) : 200000;
+
+  // a 64-bit odd modulus and full 64-bit bases and exponents, as a real
+  // group would have them
+  std::mt19937_64 random(24);
+  uint64_t modulus = random() | (1ull << 63) | 1;
+  std::vector<uint64_t> bases(count);
+  std::vector<uint64_t> exponents(count);
+  for (size_t i = 0; i < count; ++i) {
+    bases[i] = random();
+    exponents[i] = random() | (1ull << 63);
+  }
+  std::vector<uint64_t> expected(count);
+  std::vector<uint64_t> results(count);
+
+  std::cout << count << " exponentiations, 64-bit modulus and exponents\n"
+            << "method                         ns/op         ops/s\n";
+
+  // what diffie_hellman() did, with the toy group and key it could handle
+  volatile long long sink = 0;
+  report("pow() % P, P=131 x=9", count, [&]() {
+    for (size_t i = 0; i < count; ++i)
+      sink = sink + (long long)pow(static_cast<double>(bases[i] % 131), 9) % 131;
+  });
+
+  report("128-bit remainder", count, [&]() {
+    for (size_t i = 0; i < count; ++i)
+      expected[i] = modexp_remainder(bases[i], exponents[i], modulus);
+  });
+
+  DH::Montgomery group(modulus);
+  report("Montgomery", count, [&]() {
+    for (size_t i = 0; i < count; ++i)
+      results[i] = group.pow(bases[i], exponents[i]);
+  });
+  size_t wrong = mismatches(results, expected);
+
+  report("Montgomery batch", count, [&]() {
+    group.pow(bases.data(), exponents.data(), results.data(), count);
+  });
+  wrong += mismatches(results, expected);
+
+  // the server's case: its one private exponent against every client
+  uint64_t exponent = exponents[0];
+  report("Montgomery batch, one x", count, [&]() {
+    group.pow(bases.data(), exponent, results.data(), count);
+  });
+  for (size_t i = 0; i < count; ++i)
+    wrong += results[i] != group.pow(bases[i], exponent);
+
+  if (wrong != 0) {
+    std::cerr << "ERROR: " << wrong << " results differ from the reference\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dh_registry.h"
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  if (argc > 3) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " [<principals> [<registry-file>]]\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+template <typename Run>
+double timed(Run run) {
+  using namespace std::chrono;
+  steady_clock::time_point start = steady_clock::now();
+  run();
+  return duration<double>(steady_clock::now() - start).count();
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+  size_t count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+  std::string path = argc > 2 ? argv[2] : "/tmp/dh_registry_bench.reg";
+
+  // principals in a handful of groups, the way they share standard ones
+  DH::RegistryBuilder builder;
+  double build = timed([&]() {
+    uint32_t groups[4];
+    for (int i = 0; i < 4; ++i)
+      groups[i] = builder.addGroup(DH::Number(1000003 + 2 * i), DH::Number(2));
+    for (size_t i = 0; i < count; ++i)
+      builder.add("principal-" + std::to_string(i), groups[i % 4], i % 2 == 0, i & 0xFFF);
+  });
+  double write = timed([&]() {
+    if (!builder.write(path)) {
+      std::cerr << "ERROR: failed to write " << path << "\n";
+      std::exit(EXIT_FAILURE);
+    }
+  });
+
+  std::cout << count << " principals, one core\n" << std::fixed << std::setprecision(3)
+            << "  collect                  " << std::setw(10) << build * 1e3 << " ms\n"
+            << "  write                    " << std::setw(10) << write * 1e3 << " ms\n";
+  {
+    DH::Registry* opened = NULL;
+    double open = timed([&]() { opened = new DH::Registry(path); });
+    std::cout << "  open (map)               " << std::setw(10) << open * 1e3 << " ms\n";
+    delete opened;
+  }
+
+  DH::Registry registry(path);
+  std::mt19937_64 random(1);
+  const size_t kLookups = 1000000;
+  std::vector<std::string> names(kLookups);
+  for (std::string& name : names)
+    name = "principal-" + std::to_string(random() % count);
+
+  // the same names with a character that no principal has
+  size_t found = 0;
+  DH::Principal principal;
+  double hits = timed([&]() {
+    for (const std::string& name : names)
+      found += registry.find(name, principal);
+  });
+  for (std::string& name : names)
+    name += '!';
+  double misses = timed([&]() {
+    for (const std::string& name : names)
+      found += registry.find(name, principal);
+  });
+  std::cout << std::setprecision(1)
+            << "  lookup, present          " << std::setw(10) << hits / kLookups * 1e9
+            << " ns\n"
+            << "  lookup, absent           " << std::setw(10) << misses / kLookups * 1e9
+            << " ns\n";
+
+  unlink(path.c_str());
+  if (found != kLookups) {
+    std::cerr << "ERROR: " << found << " of " << kLookups << " lookups found their principal\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
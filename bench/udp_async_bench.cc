@@ -0,0 +1,130 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "des_key_bank.h"
+#include "udp_async.h"
+
+namespace {
+  // toy Diffie-Hellman group, the same size the programs use
+  const long long kP = 131;
+  const long long kG = 26;
+  const int kServerPort = 6701;
+  const int kFirstClientPort = 7001;
+  const std::chrono::milliseconds kRetry(200);
+  long retries = 0;
+}
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  if (argc > 2) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " [<sessions>]\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+long long power_mod(long long base, long long exponent) {
+  long long result = 1;
+  for (base %= kP; exponent > 0; exponent >>= 1) {
+    if (exponent & 1)
+      result = result * base % kP;
+    base = base * base % kP;
+  }
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// server side of one handshake: public value out, client's in, sealed "ok" out
+UDP::Task<void> serve(UDP::AsyncServer& server, struct sockaddr_in peer, long long secret) {
+  std::string mine = std::to_string(power_mod(kG, secret));
+  server.send(peer, mine);
+
+  UDP::Datagram datagram;
+  while (true) {
+    if (!co_await server.asyncReceive(peer, datagram, std::chrono::milliseconds(2000))) {
+      server.close(peer);  // client gave up
+      co_return;
+    }
+    if (datagram.payload != "hello")
+      break;
+    server.send(peer, mine);  // our answer got lost
+  }
+
+  uint16_t key = power_mod(std::stoll(datagram.payload), secret) & 0x3FF;
+  std::string ok = "ok";
+  DES::KeyBank::instance().cipher(key).encrypt(ok);
+  server.send(peer, ok);
+  server.close(peer);
+}
+
+// ----------------------------------------------------------------------------
+// every new sender starts a handshake of its own
+UDP::Task<void> accept(UDP::Scheduler& scheduler, UDP::AsyncServer& server) {
+  long long secret = 9;
+  while (true) {
+    UDP::Datagram hello = co_await server.asyncReceive();
+    server.open(hello.address);
+    scheduler.spawn(serve(server, hello.address, secret));
+  }
+}
+
+// ----------------------------------------------------------------------------
+UDP::Task<void> handshake(UDP::AsyncServer& client, long long secret, long* done,
+                          long total, UDP::Scheduler& scheduler) {
+  struct sockaddr_in kdc = UDP::Server::address("127.0.0.1", kServerPort);
+  UDP::Datagram datagram;
+
+  do {
+    client.send(kdc, "hello");
+  } while (!co_await client.asyncReceive(kdc, datagram, kRetry) && ++retries);
+  uint16_t key = power_mod(std::stoll(datagram.payload), secret) & 0x3FF;
+
+  std::string mine = std::to_string(power_mod(kG, secret));
+  do {
+    client.send(kdc, mine);
+  } while (!co_await client.asyncReceive(kdc, datagram, kRetry) && ++retries);
+
+  DES::KeyBank::instance().cipher(key).decrypt(datagram.payload);
+  if (datagram.payload != "ok")
+    std::cerr << "ERROR: handshake produced different keys\n";
+  if (++*done == total)
+    scheduler.stop();
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+  long sessions = argc > 1 ? std::stol(argv[1]) : 1000;
+
+  UDP::Scheduler scheduler;
+  UDP::Server kdc_socket("127.0.0.1", kServerPort);
+  UDP::AsyncServer kdc(scheduler, kdc_socket);
+  scheduler.spawn(accept(scheduler, kdc));
+
+  // one socket per client, all of them on this one thread
+  std::vector<std::unique_ptr<UDP::Server>> sockets;
+  std::vector<std::unique_ptr<UDP::AsyncServer>> clients;
+  long done = 0;
+  for (long i = 0; i < sessions; ++i) {
+    sockets.emplace_back(new UDP::Server("127.0.0.1", kFirstClientPort + i));
+    clients.emplace_back(new UDP::AsyncServer(scheduler, *sockets.back()));
+    scheduler.spawn(handshake(*clients.back(), 3 + i % 100, &done, sessions, scheduler));
+  }
+
+  using namespace std::chrono;
+  steady_clock::time_point start = steady_clock::now();
+  scheduler.run();
+  double seconds = duration<double>(steady_clock::now() - start).count();
+
+  std::cout << sessions << " concurrent handshakes on one thread: " << std::fixed
+            << std::setprecision(3) << seconds << " s, " << std::setprecision(0)
+            << done / seconds << " handshakes/s, " << retries << " retransmissions\n";
+  clients.clear();
+  return done == sessions ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,134 @@
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "udp_server.h"
+
+namespace {
+  const int kPort = 6401;
+  const size_t kBatch = 64;
+}
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  if (argc > 3) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " [<seconds> [<payload-bytes>]]\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// user plus system time of the whole process, kernel io_uring workers included
+double cpu_seconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// ----------------------------------------------------------------------------
+void report(const char* name, const UDP::Server& server, long datagrams,
+            double seconds, double cpu) {
+  const char* backend = server.backend() == UDP::Backend::kIoUring ? "io_uring" : "sockets";
+  std::cout << std::left << std::setw(9) << name << std::setw(10) << backend << std::right
+            << std::fixed << std::setprecision(0) << std::setw(13) << datagrams / seconds
+            << std::setw(12) << cpu * 1e9 / datagrams << "\n";
+}
+
+// ----------------------------------------------------------------------------
+// a plain sockets sender blasts at the server under test, which receives in
+// batches until the time is up
+void bench_receive(UDP::Backend backend, double seconds, size_t payload) {
+  UDP::ServerOptions options;
+  options.backend = backend;
+  UDP::Server receiver("127.0.0.1", kPort, options);
+
+  std::atomic<bool> done(false);
+  std::thread sender([&]() {
+    UDP::Server client("127.0.0.1", kPort + 1);
+    std::vector<UDP::Datagram> batch(kBatch);
+    for (UDP::Datagram& datagram : batch) {
+      datagram.payload.assign(payload, 'x');
+      datagram.address = UDP::Server::address("127.0.0.1", kPort);
+    }
+    while (!done.load(std::memory_order_relaxed))
+      client.sendBatch(batch);
+  });
+
+  UDP::BufferPool pool(kBatch);
+  std::vector<UDP::Buffer> buffers;
+  for (size_t i = 0; i < kBatch; ++i)
+    buffers.push_back(*pool.acquire());
+
+  using namespace std::chrono;
+  long received = 0;
+  double cpu = cpu_seconds();
+  steady_clock::time_point start = steady_clock::now();
+  steady_clock::time_point end = start + duration_cast<steady_clock::duration>(
+      duration<double>(seconds));
+  while (steady_clock::now() < end) {
+    int n = receiver.receiveBatch(buffers.data(), buffers.size());
+    if (n > 0)
+      received += n;
+  }
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+  cpu = cpu_seconds() - cpu;
+
+  done = true;
+  sender.join();
+  report("receive", receiver, received, elapsed, cpu);
+}
+
+// ----------------------------------------------------------------------------
+// the server under test sends batches to a socket nobody reads
+void bench_send(UDP::Backend backend, double seconds, size_t payload) {
+  UDP::Server sink("127.0.0.1", kPort);
+  UDP::ServerOptions options;
+  options.backend = backend;
+  UDP::Server sender("127.0.0.1", kPort + 1, options);
+
+  std::vector<UDP::Datagram> batch(kBatch);
+  for (UDP::Datagram& datagram : batch) {
+    datagram.payload.assign(payload, 'x');
+    datagram.address = UDP::Server::address("127.0.0.1", kPort);
+  }
+
+  using namespace std::chrono;
+  long sent = 0;
+  double cpu = cpu_seconds();
+  steady_clock::time_point start = steady_clock::now();
+  steady_clock::time_point end = start + duration_cast<steady_clock::duration>(
+      duration<double>(seconds));
+  while (steady_clock::now() < end) {
+    int n = sender.sendBatch(batch);
+    if (n > 0)
+      sent += n;
+  }
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+  cpu = cpu_seconds() - cpu;
+  report("send", sender, sent, elapsed, cpu);
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+  double seconds = argc > 1 ? std::stod(argv[1]) : 2.0;
+  size_t payload = argc > 2 ? std::stoul(argv[2]) : 64;
+
+  std::cout << payload << "-byte datagrams on loopback, batches of " << kBatch
+            << ", " << seconds << " s per run\n"
+            << "path     backend   datagrams/s  cpu ns/dgram\n";
+  bench_receive(UDP::Backend::kSockets, seconds, payload);
+  bench_receive(UDP::Backend::kIoUring, seconds, payload);
+  bench_send(UDP::Backend::kSockets, seconds, payload);
+  bench_send(UDP::Backend::kIoUring, seconds, payload);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "udp_server.h"
+
+namespace {
+  const int kPort = 6501;
+  const size_t kBatch = 64;
+  // the kernel's cap on segments per GSO send (UDP_MAX_SEGMENTS)
+  const size_t kMaxSegments = 64;
+  const int kSocketBuffer = 4 << 20;
+
+  enum class SendPath { kSendto, kSendmmsg, kGso };
+}
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  if (argc > 3) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " [<seconds> [<segment-bytes>]]\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// a sender thread moves segment-sized datagrams one way or another while
+// the receiver takes them in batches, with or without GRO
+void bench(const char* name, SendPath path, bool gro, double seconds, size_t segment) {
+  UDP::ServerOptions receive_options;
+  receive_options.receive_buffer = kSocketBuffer;
+  receive_options.gro = gro;
+  receive_options.count_drops = true;
+  UDP::Server receiver("127.0.0.1", kPort, receive_options);
+
+  // as many segments per super-datagram as fit in one IPv4 datagram
+  size_t segments = 65507 / segment;
+  if (segments > kMaxSegments)
+    segments = kMaxSegments;
+
+  std::atomic<bool> done(false);
+  std::atomic<long> calls(0);
+  std::thread sender([&]() {
+    UDP::ServerOptions send_options;
+    send_options.send_buffer = kSocketBuffer;
+    if (path == SendPath::kGso)
+      send_options.segment_size = static_cast<uint16_t>(segment);
+    UDP::Server client("127.0.0.1", kPort + 1, send_options);
+
+    struct sockaddr_in destination = UDP::Server::address("127.0.0.1", kPort);
+    std::string bulk(segments * segment, 'x');
+    std::vector<UDP::Datagram> batch(segments);
+    for (UDP::Datagram& datagram : batch) {
+      datagram.payload.assign(segment, 'x');
+      datagram.address = destination;
+    }
+
+    long n_calls = 0;
+    while (!done.load(std::memory_order_relaxed)) {
+      if (path == SendPath::kSendto) {
+        for (size_t i = 0; i < segments; ++i)
+          client.send(destination, bulk.data(), segment);
+        n_calls += segments;
+      } else if (path == SendPath::kSendmmsg) {
+        client.sendBatch(batch);
+        ++n_calls;
+      } else {
+        client.send(destination, bulk.data(), bulk.size());
+        ++n_calls;
+      }
+    }
+    calls = n_calls;
+  });
+
+  UDP::BufferPool pool(kBatch);
+  std::vector<UDP::Buffer> buffers;
+  for (size_t i = 0; i < kBatch; ++i)
+    buffers.push_back(*pool.acquire());
+
+  using namespace std::chrono;
+  long received = 0;
+  steady_clock::time_point start = steady_clock::now();
+  steady_clock::time_point end = start + duration_cast<steady_clock::duration>(
+      duration<double>(seconds));
+  while (steady_clock::now() < end) {
+    int n = receiver.receiveBatch(buffers.data(), buffers.size());
+    if (n > 0)
+      received += n;
+  }
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+
+  done = true;
+  sender.join();
+  std::cout << std::left << std::setw(10) << name << std::setw(5) << (gro ? "on" : "off")
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(10) << received * segment / elapsed / 1e6
+            << std::setprecision(0) << std::setw(13) << received / elapsed
+            << std::setw(14) << calls / elapsed
+            << std::setw(10) << receiver.drops() << "\n";
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+  double seconds = argc > 1 ? std::stod(argv[1]) : 2.0;
+  size_t segment = argc > 2 ? std::stoul(argv[2]) : 1400;
+  if (segment == 0 || segment > 65507) {
+    std::cerr << "ERROR: segment size must be 1 to 65507 bytes\n";
+    return EXIT_FAILURE;
+  }
+
+  std::cout << segment << "-byte datagrams on loopback, " << seconds << " s per run\n"
+            << "send      gro       MB/s  datagrams/s  send calls/s     drops\n";
+  bench("sendto", SendPath::kSendto, false, seconds, segment);
+  bench("sendmmsg", SendPath::kSendmmsg, false, seconds, segment);
+  bench("gso", SendPath::kGso, false, seconds, segment);
+  bench("gso", SendPath::kGso, true, seconds, segment);
+  return EXIT_SUCCESS;
+}
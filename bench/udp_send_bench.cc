@@ -0,0 +1,80 @@
+#include <netdb.h>
+#include <string.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "udp_server.h"
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  if (argc > 3) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " [<sends> [<payload-bytes>]]\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// what every send used to do, as the original Server::send() did it:
+// gethostbyname, build the address, sendto
+void send_resolving(int sd, const std::string& ip, int port, const std::string& buffer) {
+  struct sockaddr_in server;
+  struct hostent* hp;
+  server.sin_family = AF_INET;
+  if ((hp = gethostbyname(ip.c_str())) == NULL)
+    return;
+  memcpy(&server.sin_addr.s_addr, hp->h_addr, hp->h_length);
+  server.sin_port = htons(port);
+  sendto(sd, buffer.data(), buffer.size(), 0, (struct sockaddr* )&server, sizeof server);
+}
+
+// ----------------------------------------------------------------------------
+template <typename Send>
+double sends_per_second(long sends, Send send) {
+  using namespace std::chrono;
+  steady_clock::time_point start = steady_clock::now();
+  for (long i = 0; i < sends; ++i)
+    send();
+  return sends / duration<double>(steady_clock::now() - start).count();
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+  long sends = argc > 1 ? std::stol(argv[1]) : 200000;
+  std::string payload(argc > 2 ? std::stoul(argv[2]) : 64, 'x');
+
+  // nobody reads the sink, the kernel drops what does not fit its queue
+  const int kSinkPort = 6101;
+  UDP::Server sink("127.0.0.1", kSinkPort);
+  UDP::Server sender("127.0.0.1", kSinkPort + 1);
+  int sd = sender.getSocketDescriptor();
+
+  std::cout << sends << " sends of " << payload.size() << " bytes to 127.0.0.1:"
+            << kSinkPort << "\n" << std::fixed << std::setprecision(0);
+
+  std::cout << "gethostbyname/send  " << std::setw(9) << sends_per_second(sends, [&] {
+    send_resolving(sd, "127.0.0.1", kSinkPort, payload);
+  }) << " sends/s\n";
+
+  std::cout << "host and port       " << std::setw(9) << sends_per_second(sends, [&] {
+    sender.send("127.0.0.1", kSinkPort, payload);
+  }) << " sends/s\n";
+
+  const UDP::Endpoint& sink_endpoint = UDP::Server::endpoint("127.0.0.1", kSinkPort);
+  std::cout << "cached endpoint     " << std::setw(9) << sends_per_second(sends, [&] {
+    sender.send(sink_endpoint, payload);
+  }) << " sends/s\n";
+
+  sender.connect(sink_endpoint);
+  std::cout << "connected socket    " << std::setw(9) << sends_per_second(sends, [&] {
+    sender.send(payload);
+  }) << " sends/s\n";
+  sender.disconnect();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "des_key_bank.h"
+#include "udp_server.h"
+#include "udp_sharded.h"
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  if (argc > 3) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " [<max-shards> [<seconds>]]\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+  size_t max_shards = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+  double seconds = argc > 2 ? std::stod(argv[2]) : 2.0;
+  if (max_shards == 0)
+    max_shards = 1;
+
+  // several client endpoints so the kernel has something to spread
+  const int kServerPort = 6201;
+  const int kClients = 16;
+  const size_t kBatch = 64;
+
+  std::cout << "Handshake-sized requests from " << kClients << " client ports, "
+            << seconds << " s per run\n" << "shards  requests/s  speedup\n";
+
+  double single = 0;
+  for (size_t shards = 1; shards <= max_shards; ++shards) {
+    UDP::ShardedServer server("127.0.0.1", kServerPort + shards, shards);
+    std::atomic<long> handled(0);
+
+    // each request is decrypted, answered with a freshly encrypted reply,
+    // which is about what one KDC handshake step costs
+    server.start([&](UDP::Server& shard, size_t) {
+      DES::CipherHandle cipher = DES::KeyBank::instance().cipher(0x2D7);
+      std::vector<UDP::Datagram> batch(kBatch);
+      long local = 0;
+      while (!server.stopping()) {
+        int received = shard.receiveBatch(batch);
+        for (int i = 0; i < received; ++i) {
+          if (batch[i].payload.empty())
+            continue;
+          cipher.decrypt(batch[i].payload);
+          cipher.encrypt(batch[i].payload);
+          ++local;
+        }
+        if (received > 0)
+          shard.sendBatch(batch, received);
+      }
+      handled += local;
+    });
+
+    // clients blast requests until told to stop, replies are not read
+    std::atomic<bool> done(false);
+    std::vector<std::thread> clients;
+    for (int c = 0; c < kClients; ++c) {
+      clients.emplace_back([&, c]() {
+        UDP::Server client("127.0.0.1", kServerPort + 100 + c);
+        std::vector<UDP::Datagram> requests(kBatch);
+        for (UDP::Datagram& request : requests) {
+          request.payload.assign(48, static_cast<char>(c));
+          request.address = UDP::Server::address("127.0.0.1", kServerPort + shards);
+        }
+        while (!done.load(std::memory_order_relaxed))
+          client.sendBatch(requests);
+      });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    done = true;
+    for (std::thread& client : clients)
+      client.join();
+    server.stop();
+    server.join();
+
+    double rate = handled / seconds;
+    if (shards == 1)
+      single = rate;
+    std::cout << std::setw(6) << shards << std::fixed << std::setprecision(0)
+              << std::setw(12) << rate << std::setprecision(2)
+              << std::setw(9) << rate / single << "\n";
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "des_cipher.h"
+#include "des_key_search.h"
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  bool self_test = argc == 2 && strcmp(argv[1], "--self-test") == 0;
+  if (!self_test && argc != 3 && argc != 4) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " <plaintext-file> <ciphertext-file> [<repeat>]\n"
+              << "       " << argv[0] << " --self-test\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+std::string read_file(const char* path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in.good()) {
+    std::cerr << "ERROR: failed to open " << path << "\n";
+    std::exit(EXIT_FAILURE);
+  }
+  return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// ----------------------------------------------------------------------------
+// the slow way: one DES::Cipher per key, one sample at a time
+std::vector<uint16_t> reference_keys(const std::string& plain, const std::string& cipher) {
+  std::vector<uint16_t> keys;
+  for (uint16_t key = 0; key < 1024; ++key) {
+    DES::Cipher candidate(key);
+    std::string encrypted;
+    candidate.encrypt(plain, encrypted);
+    if (encrypted == cipher)
+      keys.push_back(key);
+  }
+  return keys;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<uint16_t> search(const std::string& plain, const std::string& cipher,
+                             DES::SliceWidth width) {
+  return DES::searchKeys(reinterpret_cast<const uint8_t*>(plain.data()),
+                         reinterpret_cast<const uint8_t*>(cipher.data()),
+                         plain.size(), width);
+}
+
+// ----------------------------------------------------------------------------
+double keys_per_second(const std::string& plain, const std::string& cipher,
+                       DES::SliceWidth width, int repeat) {
+  using namespace std::chrono;
+  steady_clock::time_point start = steady_clock::now();
+  for (int i = 0; i < repeat; ++i)
+    search(plain, cipher, width);
+  double seconds = duration<double>(steady_clock::now() - start).count();
+  return 1024.0 * repeat / seconds;
+}
+
+// ----------------------------------------------------------------------------
+// encrypt random samples under every key and make sure both slice widths
+// recover exactly what DES::Cipher says
+int self_test() {
+  std::mt19937 rng(2019);
+  int failures = 0;
+  for (uint16_t key = 0; key < 1024; ++key) {
+    DES::Cipher cipher(key);
+    std::string plain(1 + rng() % 6, '\0');
+    for (char& c : plain)
+      c = static_cast<char>(rng());
+    std::string encrypted;
+    cipher.encrypt(plain, encrypted);
+
+    std::vector<uint16_t> expected = reference_keys(plain, encrypted);
+    if (search(plain, encrypted, DES::SliceWidth::k64) != expected
+        || search(plain, encrypted, DES::SliceWidth::k256) != expected) {
+      std::cerr << "MISMATCH for key " << key << "\n";
+      ++failures;
+    }
+  }
+  std::cout << (failures ? "Self-test FAILED\n" : "Self-test passed for all 1024 keys\n");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+  if (argc == 2)
+    return self_test();
+
+  // known plaintext and the matching captured ciphertext
+  std::string plain = read_file(argv[1]);
+  std::string cipher = read_file(argv[2]);
+  if (plain.size() != cipher.size()) {
+    std::cerr << "ERROR: plaintext and ciphertext differ in length\n";
+    std::exit(EXIT_FAILURE);
+  }
+  int repeat = argc == 4 ? std::stoi(argv[3]) : 1000;
+
+  std::vector<uint16_t> keys = search(plain, cipher, DES::SliceWidth::kAuto);
+  std::cout << "Samples: " << plain.size() << "\n"
+            << "Candidate keys (" << keys.size() << "):";
+  for (uint16_t key : keys)
+    std::cout << " " << std::hex << std::setw(3) << std::setfill('0') << key;
+  std::cout << std::dec << "\n";
+
+  bool consistent = keys == reference_keys(plain, cipher);
+  std::cout << "Consistent with DES::Cipher: " << (consistent ? "yes" : "NO") << "\n";
+
+  std::cout << std::fixed << std::setprecision(1)
+            << "64-key slices:  "
+            << keys_per_second(plain, cipher, DES::SliceWidth::k64, repeat) / 1e6
+            << " Mkeys/s\n"
+            << "256-key slices: "
+            << keys_per_second(plain, cipher, DES::SliceWidth::k256, repeat) / 1e6
+            << " Mkeys/s\n";
+
+  return consistent ? EXIT_SUCCESS : EXIT_FAILURE;
+}
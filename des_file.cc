@@ -0,0 +1,180 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "des_key_bank.h"
+#include "des_parallel.h"
+
+// bytes handed to the cipher per step in each mode
+const size_t kMappedBlock = 64 << 20;
+const size_t kStreamBlock = 1 << 20;
+
+// ----------------------------------------------------------------------------
+// the key is hex and 10 bits at most, the size of the programs' keys
+inline void validate_input(int argc, char** argv, uint16_t* key) {
+  bool mode_ok = argc > 1 && (strcmp(argv[1], "encrypt") == 0
+                              || strcmp(argv[1], "decrypt") == 0);
+  bool key_ok = false;
+  if (argc > 2) {
+    char* end;
+    errno = 0;
+    unsigned long value = strtoul(argv[2], &end, 16);
+    key_ok = *argv[2] != '\0' && *argv[2] != '-' && *end == '\0' && errno == 0 &&
+             value < DES::KeyBank::kKeyCount;
+    *key = static_cast<uint16_t>(value);
+  }
+  if (!mode_ok || !key_ok || (argc != 3 && argc != 5)) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " encrypt|decrypt <key-hex> <input> <output>\n"
+              << "       " << argv[0] << " encrypt|decrypt <key-hex> < input > output\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+[[noreturn]] void fail(const char* call) {
+  std::cerr << "ERROR: " << strerror(errno) << "\n" << call << " failed" << std::endl;
+  std::exit(EXIT_FAILURE);
+}
+
+// ----------------------------------------------------------------------------
+void report(size_t bytes, std::chrono::steady_clock::time_point start) {
+  using namespace std::chrono;
+  double seconds = duration<double>(steady_clock::now() - start).count();
+  std::cerr << "Processed " << bytes << " bytes in " << std::fixed
+            << std::setprecision(3) << seconds << " s ("
+            << std::setprecision(1) << (seconds > 0 ? bytes / seconds / 1e6 : 0)
+            << " MB/s)" << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+// map both files and run the bulk cipher over them one large block at a time
+size_t process_mapped(const DES::ParallelCipher& cipher, bool encrypting,
+                      const char* input_path, const char* output_path) {
+  int in = open(input_path, O_RDONLY);
+  if (in < 0)
+    fail("open()");
+
+  struct stat info;
+  if (fstat(in, &info) < 0)
+    fail("fstat()");
+  // a pipe or a device has no size to map, it would come out empty
+  if (!S_ISREG(info.st_mode)) {
+    std::cerr << "ERROR: " << input_path << " is not a regular file; pipes and devices"
+              << " go through stdin and stdout\n";
+    std::exit(EXIT_FAILURE);
+  }
+  size_t size = info.st_size;
+
+  // truncating the output must not destroy the input, under any name
+  struct stat existing;
+  if (stat(output_path, &existing) == 0 && existing.st_dev == info.st_dev &&
+      existing.st_ino == info.st_ino) {
+    std::cerr << "ERROR: " << input_path << " and " << output_path << " are the same file\n";
+    std::exit(EXIT_FAILURE);
+  }
+
+  int out = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (out < 0)
+    fail("open()");
+  if (ftruncate(out, size) < 0)
+    fail("ftruncate()");
+
+  // mmap() rejects empty mappings, and there is nothing to do anyway
+  if (size > 0) {
+    void* source = mmap(NULL, size, PROT_READ, MAP_SHARED, in, 0);
+    if (source == MAP_FAILED)
+      fail("mmap()");
+    void* target = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, out, 0);
+    if (target == MAP_FAILED)
+      fail("mmap()");
+
+    // both are walked front to back exactly once
+    madvise(source, size, MADV_SEQUENTIAL);
+    madvise(target, size, MADV_SEQUENTIAL);
+
+    const uint8_t* from = static_cast<const uint8_t*>(source);
+    uint8_t* to = static_cast<uint8_t*>(target);
+    for (size_t offset = 0; offset < size; offset += kMappedBlock) {
+      size_t length = size - offset < kMappedBlock ? size - offset : kMappedBlock;
+      if (encrypting)
+        cipher.encrypt(from + offset, to + offset, length);
+      else
+        cipher.decrypt(from + offset, to + offset, length);
+
+      // the input block will not be read again
+      madvise(const_cast<uint8_t*>(from) + offset, length, MADV_DONTNEED);
+    }
+
+    munmap(source, size);
+    munmap(target, size);
+  }
+
+  close(in);
+  if (close(out) < 0)
+    fail("close()");
+  return size;
+}
+
+// ----------------------------------------------------------------------------
+// stdin to stdout through one fixed buffer, so pipes of any length work
+size_t process_stream(DES::CipherHandle cipher, bool encrypting) {
+  std::vector<uint8_t> buffer(kStreamBlock);
+  size_t total = 0;
+  while (true) {
+    ssize_t n_read = read(STDIN_FILENO, buffer.data(), buffer.size());
+    if (n_read < 0) {
+      if (errno == EINTR)
+        continue;
+      fail("read()");
+    }
+    if (n_read == 0)
+      break;
+
+    if (encrypting)
+      cipher.encrypt(buffer.data(), n_read);
+    else
+      cipher.decrypt(buffer.data(), n_read);
+
+    // write() may take less than everything on a pipe
+    for (ssize_t written = 0; written < n_read;) {
+      ssize_t n = write(STDOUT_FILENO, buffer.data() + written, n_read - written);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        fail("write()");
+      }
+      written += n;
+    }
+    total += n_read;
+  }
+  return total;
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  uint16_t key;
+  validate_input(argc, argv, &key);
+  bool encrypting = strcmp(argv[1], "encrypt") == 0;
+  DES::CipherHandle cipher = DES::KeyBank::instance().cipher(key);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  size_t bytes;
+  if (argc == 5)
+    bytes = process_mapped(DES::ParallelCipher(cipher), encrypting, argv[3], argv[4]);
+  else
+    bytes = process_stream(cipher, encrypting);
+
+  report(bytes, start);
+  return EXIT_SUCCESS;
+}
@@ -1,27 +1,51 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <chrono>
-#include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
 
 #include "des_cipher.h"
+#include "des_ctr.h"
+#include "dh_group.h"
+#include "udp_frame.h"
+#include "udp_reactor.h"
 #include "udp_server.h"
+#include "udp_transport.h"
 
-long long dh_private_key = 3;
 std::string name = "Iron Man";
 
 int TTL = 100;
 
+// How long to wait for Thor once our private key is in. The KDC says so
+// after ten minutes if he never came, unless it was started with a
+// --pairing of its own
+const std::chrono::seconds kPairingWait{660};
+
 // ----------------------------------------------------------------------------
-void read_public_info(char** argv, long long* P, long long* G) {
-  // read my public info for Diffie Hellman
+void read_public_info(char** argv, DH::Number* P, DH::Number* G) {
+  // read my public info for Diffie Hellman, numbers of any size
   std::ifstream in(argv[1]);
   if (!in.good()) {
     std::cerr << "ERROR: failed to open key file\n";
     std::exit(EXIT_FAILURE);
   }
 
-  in >> *P >> *G;
+  std::string P_text, G_text;
+  in >> P_text >> G_text;
+  if (!DH::Number::parse(P_text, *P) || !DH::Number::parse(G_text, *G)) {
+    std::cerr << "ERROR: failed to read P and G from the key file\n";
+    std::exit(EXIT_FAILURE);
+  }
   std::cout << "Generating a session key with my (" << name 
             << ") public info:\nP: " << *P << "\nG: " << *G 
             << std::endl;
@@ -29,32 +53,63 @@ void read_public_info(char** argv, long long* P, long long* G) {
 
 // ----------------------------------------------------------------------------
 inline void validate_input(int argc, char** argv) {
-  if (argc == 3) {
+  if (argc == 3 || argc == 5 || (argc == 6 && strlen(argv[5]) <= 255)) {
     std::cout << argv[2] << "\n";
     TTL = std::stoi(argv[2]);
     std::cout << TTL << "\n";
   } else if (argc != 2) {
     std::cerr << "Invalid Argument(s).\n";
-    std::cerr << "USAGE: " << argv[0] << " <keys-file>\n";
+    std::cerr << "USAGE: " << argv[0]
+              << " <keys-file> [<time-to-live> [<port> <thor-port> [<name>]]]\n";
     std::exit(EXIT_FAILURE);
   }
 }
 
 // ----------------------------------------------------------------------------
-uint16_t diffie_hellman(UDP::Server& server, int port, long long P, long long G) {
-  // generate key and send to server
-  long long generated_key = (long long)pow(G, dh_private_key) % P;
-  server.send("127.0.0.1", port, std::to_string(generated_key));
+uint32_t new_session_id() {
+  std::random_device random;
+  uint32_t session;
+  do {
+    session = random();
+  } while (session == UDP::kAnySession);
+  return session;
+}
 
-  // wait to receive a message from user
+// ----------------------------------------------------------------------------
+uint16_t diffie_hellman(UDP::Transport& transport, int port, const DH::Group& group,
+                        uint32_t session, const std::string& principal, int peer_port) {
+  // generate key and send it to the server until it answers with its own.
+  // The server also learns who we are, who we want to talk to, and as which
+  // end
+  DH::Number private_key, generated_key;
+  group.generate(private_key, generated_key);
+  size_t width = group.width();
+  std::vector<uint8_t> payload(width + principal.size() + UDP::kDhRequestTrailer);
+  generated_key.toBytes(payload.data(), width);
+  std::copy(principal.begin(), principal.end(), payload.begin() + width);
+  size_t trailer = width + principal.size();
+  payload[trailer] = static_cast<uint8_t>(principal.size());
+  UDP::putU16(&payload[trailer + 1], static_cast<uint16_t>(peer_port));
+  payload[trailer + 3] = static_cast<uint8_t>(UDP::Role::kResponder);
   std::string buffer;
-  server.receive(buffer);
-  long long received_key = (long long)stoi(buffer);
+  UDP::Frame frame;
+  struct sockaddr_in server = UDP::Server::address("127.0.0.1", port);
+  if (!transport.request(server, UDP::MessageType::kDhPublic, session, payload.data(),
+                         payload.size(), UDP::MessageType::kDhPublic, buffer, frame) ||
+      frame.length != width) {
+    std::exit(EXIT_FAILURE);
+  }
+  DH::Number received_key = DH::Number::fromBytes(frame.payload, frame.length);
+  if (!group.acceptable(received_key)) {
+    std::cerr << "ERROR: the server's public value is not acceptable\n";
+    std::exit(EXIT_FAILURE);
+  }
 
   // compute session key
-  long long session_key = (long long)pow(received_key, dh_private_key) % P;
+  DH::Number secret = group.pow(received_key, private_key);
 
   // strip off all but ten least significant bits
+  uint64_t session_key = secret.low();
   session_key &= 0x3FF;
   session_key ^= 0x3FF;
 
@@ -62,96 +117,305 @@ uint16_t diffie_hellman(UDP::Server& server, int port, long long P, long long G)
 }
 
 // ----------------------------------------------------------------------------
-void secure_messaging(UDP::Server& server, DES::Cipher& session_cipher,
-                      int port) {
-  std::string msg;
+// what it takes to come back to the server without a new exchange
+struct Resumption {
+  uint64_t ticket;
+  uint16_t session_key;
+  // ms since the epoch
+  unsigned long long expires;
+};
+
+// ----------------------------------------------------------------------------
+std::string resumption_path(int port) {
+  return "iron-man-" + std::to_string(port) + ".resume";
+}
+
+// ----------------------------------------------------------------------------
+bool load_resumption(const std::string& path, Resumption* resumption) {
+  std::ifstream in(path);
+  if (!(in >> resumption->ticket >> resumption->session_key >> resumption->expires))
+    return false;
+  using namespace std::chrono;
+  milliseconds ms = duration_cast< milliseconds >(system_clock::now().time_since_epoch());
+  return resumption->expires > static_cast<unsigned long long>(ms.count());
+}
+
+// ----------------------------------------------------------------------------
+void save_resumption(const std::string& path, const Resumption& resumption) {
+  // The session key is in there, so only we may read it, from the moment
+  // the file exists. A new file is written and renamed over the old one,
+  // whatever the old one's permissions were
+  std::string text = std::to_string(resumption.ticket) + " " +
+                     std::to_string(resumption.session_key) + " " +
+                     std::to_string(resumption.expires) + "\n";
+  std::string temporary = path + ".tmp";
+  unlink(temporary.c_str());
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  bool saved = fd >= 0 && write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+  saved = fd >= 0 && close(fd) == 0 && saved && rename(temporary.c_str(), path.c_str()) == 0;
+  if (!saved) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nfailed to save the resumption ticket to "
+              << path << "\n";
+    unlink(temporary.c_str());
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Come back with the ticket from last time and the private key under the
+// session key it stands for: one round trip instead of the exchange, the
+// prompt and the private key. false if the server does not know the ticket
+// any more
+bool resume(UDP::Transport& transport, const struct sockaddr_in& server,
+            const Resumption& resumption, uint32_t session, int peer_port,
+            uint16_t private_key) {
+  uint8_t payload[UDP::kResumeRequestSize];
+  UDP::putU64(payload, resumption.ticket);
+  UDP::putU16(payload + 8, private_key);
+  DES::Cipher(resumption.session_key).encrypt(payload + 8, 2);
+  UDP::putU16(payload + 10, static_cast<uint16_t>(peer_port));
+  payload[12] = static_cast<uint8_t>(UDP::Role::kResponder);
   std::string buffer;
-  fd_set read_fd_set;
-  int sd = server.getSocketDescriptor();
+  UDP::Frame frame;
+  if (!transport.request(server, UDP::MessageType::kResume, session, payload, sizeof(payload),
+                         UDP::MessageType::kResume, buffer, frame) ||
+      frame.length != 1) {
+    std::exit(EXIT_FAILURE);
+  }
+  return frame.payload[0] == 1;
+}
 
+// ----------------------------------------------------------------------------
+// The first word of the next line on stdin that has one. Read a byte at a
+// time rather than with std::cin, which would read ahead: the lines after
+// the key are for the reactor, which reads stdin itself
+std::string read_key() {
+  std::string line, word;
+  char c;
   while (true) {
-    struct timeval timeout;
-    timeout.tv_sec = 60;
-    timeout.tv_usec = 500;  // 60 AND 500 microseconds
-
-    // reset the fd set for UDP socket and stdin
-    FD_ZERO(&read_fd_set);
-    FD_SET(sd, &read_fd_set);
-    FD_SET(STDIN_FILENO, &read_fd_set);
-
-    // check if any file descriptors are ready to be read from
-    int ready = select(FD_SETSIZE, &read_fd_set, NULL, NULL, &timeout);
-    if (ready == 0) {
-        std::cout << "No activity\n";
+    ssize_t n_bytes = read(STDIN_FILENO, &c, 1);
+    if (n_bytes < 0 && errno == EINTR)
+      continue;
+    if (n_bytes == 1 && c != '\n') {
+      line += c;
+      continue;
+    }
+    std::istringstream words(line);
+    if (words >> word || n_bytes != 1)
+      return word;
+    line.clear();
+  }
+}
+
+// ----------------------------------------------------------------------------
+void secure_messaging(UDP::Server& server, const DES::Cipher& session_cipher,
+                      int port, uint32_t session, UDP::Transport& transport) {
+  // messages are sent in counter mode as kChat frames whose sequence number
+  // is the counter. Our own keystream starts at a random nonce and is
+  // prefetched between sends
+  std::random_device random;
+  uint64_t nonce = (static_cast<uint64_t>(random()) << 32) | random();
+  DES::CtrCipher session_ctr(session_cipher.handle(), nonce);
+
+  // one buffer for the whole session, messages are translated in place
+  std::vector<uint8_t> landing(UDP::kMaxBuffer);
+  UDP::Buffer buffer;
+  buffer.data = landing.data();
+  buffer.capacity = landing.size();
+  std::string msg;
+  UDP::Reactor reactor;
+
+  // From here on we only talk to one peer. Until the socket is connected to
+  // it, the end of the handshake may still be resent, by the KDC or by the
+  // peer, if an acknowledgement got lost: answer those for as long as the
+  // sender could be backing off
+  const UDP::Endpoint& peer = UDP::Server::endpoint("127.0.0.1", port);
+  server.setBlocking(false);
+  reactor.addTimer(transport.options().max_rto, [&]() {
+    server.connect(peer);
+  }, false);
+
+  // nag after a minute without traffic in either direction
+  int idle = reactor.addTimer(std::chrono::seconds(60), []() {
+    std::cout << "No activity\n";
+  });
+
+  // receive messages, print them to terminal. Edge triggered, so take
+  // everything that is queued
+  reactor.watch(server.getSocketDescriptor(), [&]() {
+    reactor.resetTimer(idle);
+    UDP::Frame frame;
+    while (server.receive(buffer) >= 0) {
+      if (!UDP::parseFrame(buffer.data, buffer.length, frame)) {
+        std::cerr << "ERROR: dropped a malformed message\n";
+        continue;
+      }
+      if (frame.header.type != UDP::MessageType::kChat || frame.header.session != session) {
+        // late acknowledgements are harmless
+        if (!transport.answer(frame.header, buffer.address) &&
+            frame.header.type != UDP::MessageType::kAck)
+          std::cerr << "ERROR: dropped a message from outside the session\n";
         continue;
+      }
 
-    // receive a message, print it to terminal
-    } else if (FD_ISSET(sd, &read_fd_set)) {
-      server.receive(buffer);
+      // decrypt the payload where it landed
+      uint8_t* text = buffer.data + UDP::kFrameHeaderSize;
       std::cout << "Received encrypted message. Decrypting...\n";
-      session_cipher.decrypt(buffer, msg);
-      std::cout << msg << std::endl;
-
-    // read stdin, send it to user 
-    } else if (FD_ISSET(STDIN_FILENO, &read_fd_set)) {
-      std::getline(std::cin, buffer);
-      session_cipher.encrypt(buffer, msg);
-      server.send("127.0.0.1", port, msg);
+      session_ctr.decryptAt(frame.header.sequence, text, frame.length);
+      std::cout.write(reinterpret_cast<char*>(text), frame.length) << std::endl;
     }
-  }
+  });
+
+  // send every line of stdin to user, once stdin is closed we only listen
+  reactor.watchLines(STDIN_FILENO, [&](std::string& line) {
+    reactor.resetTimer(idle);
+    if (line.size() > UDP::kMaxFramePayload) {
+      std::cerr << "ERROR: message too long, not sent\n";
+      return;
+    }
+    uint64_t counter = session_ctr.counter();
+    session_ctr.encrypt(line);
+    UDP::buildFrame(msg, UDP::MessageType::kChat, session, counter, line.data(), line.size());
+    if (server.isConnected())
+      server.send(msg);
+    else
+      server.send(peer, msg);
+
+    // replenish the keystream now that the message is out
+    session_ctr.prefetch();
+  }, []() {});
+
+  reactor.run();
 }
 
 // ============================================================================
 int main(int argc, char** argv) {
   validate_input(argc, argv);
 
-  long long P, G;
+  DH::Number P, G;
   read_public_info(argv, &P, &G);
+  DH::Group group(P, G);
 
-  // start the UDP client
-  int port = 5002;
-  int port_alice = 5001;
+  // start the UDP client. Pairs other than the default one need ports of
+  // their own
+  int port = argc >= 5 ? std::stoi(argv[3]) : 5002;
+  int port_alice = argc >= 5 ? std::stoi(argv[4]) : 5001;
+  // the name the server knows us by, if it keeps a registry
+  std::string principal = argc == 6 ? argv[5] : "iron-man";
   std::string host = "127.0.0.1";
   UDP::Server server(host, port);
+  UDP::Transport transport(server);
 
-  // establish a secure connection with the server
+  // establish a secure connection with the server: come back with the
+  // ticket from last time if there is one, otherwise agree on a session key
+  // and answer the server's prompt, which gets us a ticket for next time
   int server_port = 5000;
-  uint16_t session_key_server = diffie_hellman(server, server_port, P, G);
-  DES::Cipher cipher_server(session_key_server);
-
-  std::cout << "\nThe session key with the server is " << session_key_server << std::endl;
+  struct sockaddr_in kdc = UDP::Server::address("127.0.0.1", server_port);
+  uint32_t session_server = new_session_id();
+  std::string resumption_file = resumption_path(port);
+  Resumption resumption;
+  std::string str_private_key;
+  uint16_t private_key = 0;
+  bool resumed = false;
+  if (load_resumption(resumption_file, &resumption)) {
+    std::cout << "\nResuming the session with the server, whose session key is "
+              << resumption.session_key << ".\n"
+              << "Please input the secret key you wish to use with Thor (3-digit hex):"
+              << std::endl;
+    str_private_key = read_key();
+    private_key = std::stoi(str_private_key, nullptr, 16);
+    resumed = resume(transport, kdc, resumption, session_server, port_alice, private_key);
+    if (!resumed) {
+      std::cout << "The server no longer knows the session, starting over" << std::endl;
+      std::remove(resumption_file.c_str());
+    }
+  }
 
-  // wait for prompt from the server
   std::string buffer;
-  server.receive(buffer);
-  std::cout << "\nReceived encrypted message: " << buffer << "\nDecrypting...\n";
-  std::string decrypted;
-  cipher_server.decrypt(buffer, decrypted);
-  std::cout << decrypted << std::endl;
+  UDP::Frame frame;
+  uint8_t payload[8];
+  if (!resumed) {
+    uint16_t session_key_server = diffie_hellman(transport, server_port, group, session_server,
+                                                 principal, port_alice);
+    DES::Cipher cipher_server(session_key_server);
 
-  // enter the private key you want to use and send to server
-  std::string str_private_key;
-  std::cin >> str_private_key;
-  std::string encrypted;
-  cipher_server.encrypt(str_private_key, encrypted);
-  server.send("127.0.0.1", server_port, encrypted);
-  uint16_t private_key = std::stoi(str_private_key, nullptr, 16);
+    std::cout << "\nThe session key with the server is " << session_key_server << std::endl;
+
+    // wait for prompt from the server
+    if (!transport.receiveRequest(UDP::MessageType::kKeyPrompt, session_server, buffer, frame,
+                                  kdc, transport.patience())) {
+      std::cerr << "ERROR: the server did not send its prompt" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    transport.acknowledge(kdc, frame.header);
+    std::string decrypted(reinterpret_cast<const char*>(frame.payload), frame.length);
+    std::cout << "\nReceived encrypted message: " << decrypted << "\nDecrypting...\n";
+    cipher_server.decrypt(decrypted);
+    std::cout << decrypted << std::endl;
 
-  // wait for the Alice to forward the session key from the server
+    // enter the private key you want to use, unless that happened already,
+    // and send it to the server. The server may repeat itself meanwhile, if
+    // our acknowledgement got lost
+    if (str_private_key.empty()) {
+      transport.serveUntilReadable(STDIN_FILENO);
+      str_private_key = read_key();
+      private_key = std::stoi(str_private_key, nullptr, 16);
+    }
+    UDP::putU16(payload, private_key);
+    cipher_server.encrypt(payload, 2);
+    if (!transport.request(kdc, UDP::MessageType::kPrivateKey, session_server, payload, 2,
+                           UDP::MessageType::kResumption, buffer, frame) ||
+        frame.length != UDP::kResumptionSize) {
+      std::exit(EXIT_FAILURE);
+    }
+
+    // keep the ticket the server answered with for next time
+    uint8_t reply[UDP::kResumptionSize];
+    cipher_server.decrypt(frame.payload, reply, sizeof(reply));
+    using namespace std::chrono;
+    milliseconds ms = duration_cast< milliseconds >(system_clock::now().time_since_epoch());
+    resumption.ticket = UDP::getU64(reply);
+    resumption.session_key = session_key_server;
+    resumption.expires = ms.count() + 1000ULL * UDP::getU32(reply + 8);
+    save_resumption(resumption_file, resumption);
+  }
+
+  // wait for the Alice to forward the session key from the server. An empty
+  // ticket from the server means she never came
   DES::Cipher private_cipher(private_key);
-  server.receive(buffer);
-  private_cipher.decrypt(buffer, decrypted);
+  struct sockaddr_in alice;
+  do {
+    if (!transport.receiveRequest(UDP::MessageType::kTicket, UDP::kAnySession, buffer, frame,
+                                  alice, kPairingWait)) {
+      std::cerr << "ERROR: no ticket from Thor" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    if (frame.length == 0 && alice.sin_addr.s_addr == kdc.sin_addr.s_addr &&
+        alice.sin_port == kdc.sin_port) {
+      transport.acknowledge(kdc, frame.header);
+      std::cerr << "ERROR: Thor did not come, the server gave up waiting" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+  } while (frame.length != 2);
+  uint32_t session_alice = frame.header.session;
+  uint8_t ticket[2];
+  private_cipher.decrypt(frame.payload, ticket, sizeof(ticket));
 
   // receive the timestamp and verify that the key is fresh
-  server.receive(buffer);
-  std::string str_timestamp;
-  private_cipher.decrypt(buffer, str_timestamp);
+  do {
+    if (!transport.receiveRequest(UDP::MessageType::kTimestamp, session_alice, buffer, frame,
+                                  alice, transport.patience())) {
+      std::cerr << "ERROR: no timestamp from Thor" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+  } while (frame.length != 8);
+  private_cipher.decrypt(frame.payload, payload, 8);
+  transport.acknowledge(alice, frame.header);
 
   // check for a replay attack
   using namespace std::chrono;
   milliseconds ms = duration_cast< milliseconds >(system_clock::now().time_since_epoch());
   unsigned long long timestamp = ms.count();
-  unsigned long long server_ts = std::stoull(str_timestamp);
+  unsigned long long server_ts = UDP::getU64(payload);
 
   int diff = timestamp - server_ts;
   if (diff > TTL) {
@@ -159,12 +423,12 @@ int main(int argc, char** argv) {
     std::exit(EXIT_SUCCESS);
   }
   
-  uint16_t session_key_alice = std::stoi(decrypted);
+  uint16_t session_key_alice = UDP::getU16(ticket);
   std::cout << "Session key with Thor: " << session_key_alice << std::endl;
   DES::Cipher cipher_session_alice(session_key_alice);
 
   // run the secure messaging server
-  secure_messaging(server, cipher_session_alice, port_alice);
+  secure_messaging(server, cipher_session_alice, port_alice, session_alice, transport);
 
   return EXIT_SUCCESS;
 }
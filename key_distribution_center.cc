@@ -1,191 +1,927 @@
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
 #include <chrono>
-#include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <string>
-
-#include "des_cipher.h"
+#include <unordered_map>
+#include <vector>
+
+#include "des_key_bank.h"
+#include "dh_group.h"
+#include "dh_registry.h"
+#include "dh_session_cache.h"
+#include "udp_frame.h"
+#include "udp_reactor.h"
 #include "udp_server.h"
-
-long long private_key = 9;
+#include "udp_sharded.h"
+#include "udp_transport.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// how far a client has got with us
+enum class Stage {
+  kPrompting, // session key agreed, the prompt is out but not acknowledged
+  kPrompted,  // waiting for the private key to be typed in
+  kReady,     // private key here, waiting for the peer to get this far
+  kIssuing,   // initiator only: session key, ticket and timestamp are out
+  kDismissing // the peer never came, the client is being told so
+};
+
+// One client's handshake. There is one per client endpoint at a time, and a
+// request only counts if it also carries the session id the handshake was
+// opened with. Apart from our public value and the few short frames of a
+// request in flight it takes a fixed amount of memory.
+struct Handshake {
+  struct sockaddr_in client;
+  uint32_t session;
+  UDP::Role role;
+  // who the client is and the key it registered, with a registry only
+  std::string name;
+  uint64_t record;
+  bool has_key;
+  uint16_t registered_key;
+  int peer_port;
+  Stage stage;
+  // our half of the Diffie-Hellman exchange, as sent
+  std::vector<uint8_t> public_value;
+  uint16_t session_key;
+  uint16_t private_key;
+  // what the client can come back with to skip the exchange next time
+  uint64_t ticket;
+  Clock::time_point heard;
+
+  // our request in flight, done once the client acknowledges its last frame
+  std::vector<std::string> frames;
+  uint32_t reply_session;
+  uint64_t reply_sequence;
+  int attempts;
+  Clock::time_point sent;
+  Clock::time_point deadline;
+};
+
+struct Settings {
+  // principals and their groups come from this registry rather than from
+  // two key files
+  const char* registry = NULL;
+  // keep serving pairs instead of shutting down after the first one
+  bool serve = false;
+  // handshakes that have not heard from their client for this long are
+  // dropped, typing in a key included
+  std::chrono::seconds idle{120};
+  // how long a client with its private key in waits for its peer to get
+  // that far, before it is told that nobody came
+  std::chrono::seconds pairing{600};
+  // handshakes in progress at once; requests for more are ignored until
+  // some finish or expire
+  size_t max_sessions = 1024;
+  // session keys kept for clients to resume with, and for how long after
+  // they were agreed on
+  size_t cache_memory = 1 << 20;
+  std::chrono::seconds cache_ttl{3600};
+  // sockets on the port, each with a thread of its own; 0 is one per core.
+  // The handshakes and the cache are split evenly among them
+  size_t shards = 0;
+};
+
+struct Kdc;
+
+// a handshake with its private key in, as it was when it started waiting
+// for its peer, and the shard that has it
+struct Waiting {
+  size_t shard;
+  Handshake handshake;
+};
+
+// What the shards have in common. The kernel hands every client endpoint
+// to one shard, which keeps its handshake, but the two ends of a pair may
+// land on different ones: they meet in the pairing table.
+struct Shared {
+  Shared(const DH::Registry* registry) : registry(registry) {}
+
+  // Without a registry there are two groups, the initiator's and the
+  // responder's. With one, each of its groups is built the first time a
+  // principal in it turns up, on whichever shard that is
+  const DH::Registry* registry;
+  std::mutex groups_mutex;
+  std::vector<std::unique_ptr<DH::Group>> groups;
+  // ready handshakes by client endpoint
+  std::mutex ready_mutex;
+  std::unordered_map<uint64_t, Waiting> ready;
+  std::vector<Kdc*> shards;
+  std::atomic<unsigned long> pairs{0};
+};
+
+// everything the event handlers of one shard share
+struct Kdc {
+  Kdc(Shared& shared, size_t index, UDP::Server& server, const Settings& settings,
+      const UDP::TransportOptions& options)
+      : shared(shared), index(index), server(server), transport(server, options),
+        settings(settings), registry(shared.registry),
+        cache(settings.cache_memory, settings.cache_ttl) {
+    this->wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->wakeup < 0) {
+      std::cerr << "ERROR: " << strerror(errno) << "\neventfd() failed" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  ~Kdc() { close(this->wakeup); }
+
+  // copying and moving not allowed
+  Kdc(const Kdc& rhs) = delete;
+  Kdc(Kdc&& rhs) = delete;
+  Kdc& operator=(const Kdc& rhs) = delete;
+  Kdc& operator=(Kdc&& rhs) = delete;
+
+  Shared& shared;
+  size_t index;
+  UDP::Server& server;
+  UDP::Transport transport;
+  Settings settings;
+  UDP::Reactor reactor;
+  const DH::Registry* registry;
+  std::unordered_map<uint64_t, Handshake> handshakes;
+  // session keys of finished exchanges, by resumption ticket. A client
+  // resumes from the endpoint it started from, so on the same shard
+  DH::SessionCache cache;
+  // work other shards hand over, and what wakes the reactor for it
+  std::mutex inbox_mutex;
+  std::vector<std::function<void(Kdc&)>> inbox;
+  int wakeup;
+};
 
 
 // ----------------------------------------------------------------------------
-inline void validate_input(int argc, char** argv) {
-  if (argc != 3) {
+inline void validate_input(int argc, char** argv, Settings* settings) {
+  // the two key files, unless there is a registry among the options
+  int first = argc >= 3 && argv[1][0] != '-' ? 3 : 1;
+  bool valid = true;
+  for (int i = first; valid && i < argc; ++i) {
+    if (strcmp(argv[i], "--registry") == 0 && i + 1 < argc)
+      settings->registry = argv[++i];
+    else if (strcmp(argv[i], "--serve") == 0)
+      settings->serve = true;
+    else if (strcmp(argv[i], "--idle") == 0 && i + 1 < argc)
+      settings->idle = std::chrono::seconds(std::stoi(argv[++i]));
+    else if (strcmp(argv[i], "--pairing") == 0 && i + 1 < argc)
+      settings->pairing = std::chrono::seconds(std::stoi(argv[++i]));
+    else if (strcmp(argv[i], "--max-sessions") == 0 && i + 1 < argc)
+      settings->max_sessions = std::stoul(argv[++i]);
+    else if (strcmp(argv[i], "--cache-memory") == 0 && i + 1 < argc)
+      settings->cache_memory = std::stoul(argv[++i]);
+    else if (strcmp(argv[i], "--cache-ttl") == 0 && i + 1 < argc)
+      settings->cache_ttl = std::chrono::seconds(std::stoi(argv[++i]));
+    else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+      settings->shards = std::stoul(argv[++i]);
+    else
+      valid = false;
+  }
+  if (!valid || settings->max_sessions == 0 || (first == 1) == (settings->registry == NULL)) {
     std::cerr << "Invalid Argument(s).\n";
-    std::cerr << "USAGE: " << argv[0] << " <keys-file>\n";
+    std::cerr << "USAGE: " << argv[0] << " <thor-keys-file> <iron-man-keys-file> [<options>]\n"
+              << "       " << argv[0] << " --registry <registry-file> [<options>]\n"
+              << "OPTIONS: [--serve] [--idle <seconds>] [--pairing <seconds>]"
+              << " [--max-sessions <count>] [--cache-memory <bytes>] [--cache-ttl <seconds>]"
+              << " [--shards <count>]\n";
     std::exit(EXIT_FAILURE);
-  } 
+  }
 }
 
 // ----------------------------------------------------------------------------
-void read_public_info(char** argv, long long* P_alice, long long* G_alice, 
-                      long long* P_bob, long long* G_bob) {
-  // read Alice and Bob's keys
-  std::ifstream in(argv[1]);
+void read_group(const char* path, DH::Number* P, DH::Number* G) {
+  std::ifstream in(path);
   if (!in.good()) {
     std::cerr << "ERROR: failed to open key file\n";
     std::exit(EXIT_FAILURE);
   }
-  in >> *P_alice >> *G_alice;
+  std::string P_text, G_text;
+  in >> P_text >> G_text;
+  if (!DH::Number::parse(P_text, *P) || !DH::Number::parse(G_text, *G)) {
+    std::cerr << "ERROR: failed to read P and G from " << path << "\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+void read_public_info(char** argv, DH::Number* P_alice, DH::Number* G_alice,
+                      DH::Number* P_bob, DH::Number* G_bob) {
+  // read Alice and Bob's keys
+  read_group(argv[1], P_alice, G_alice);
   std::cout << "Thor's public info: \n"
             << "P: " << *P_alice << "\n"
             << "G: " << *G_alice << std::endl;
 
-  in.close();
-  in.open(argv[2]);
-  if (!in.good()) {
-    std::cerr << "ERROR: failed to open key file\n";
-    std::exit(EXIT_FAILURE);
-  }  
-
-  in >> *P_bob >> *G_bob;
+  read_group(argv[2], P_bob, G_bob);
   std::cout << "\nIron Man's public info: \n"
             << "P: " << *P_bob << "\n"
             << "G: " << *G_bob << std::endl;
 }
 
 // ----------------------------------------------------------------------------
-uint16_t diffie_hellman(UDP::Server& server, int port, long long P, long long G) {
-  // wait to receive a message from user
-  std::string buffer;
-  server.receive(buffer);
-  long long received_key = (long long)stoi(buffer);
+uint64_t endpoint_key(const struct sockaddr_in& address) {
+  return (static_cast<uint64_t>(ntohl(address.sin_addr.s_addr)) << 16) |
+         ntohs(address.sin_port);
+}
+
+// ----------------------------------------------------------------------------
+std::ostream& operator<<(std::ostream& out, const Handshake& handshake) {
+  if (!handshake.name.empty())
+    out << handshake.name;
+  else
+    out << (handshake.role == UDP::Role::kInitiator ? "Thor" : "Iron Man");
+  return out << " (" << inet_ntoa(handshake.client.sin_addr) << ":"
+             << ntohs(handshake.client.sin_port) << ")";
+}
+
+// ----------------------------------------------------------------------------
+// The group a client does Diffie-Hellman in, and with a registry what it
+// says about the client. NULL if the registry does not know the client
+const DH::Group* find_group(Kdc& kdc, UDP::Role role, const char* name, size_t length,
+                            DH::Principal* principal) {
+  std::vector<std::unique_ptr<DH::Group>>& groups = kdc.shared.groups;
+  if (kdc.registry == NULL)
+    return groups[role == UDP::Role::kInitiator ? 0 : 1].get();
+
+  if (!kdc.registry->find(name, length, *principal) || principal->group >= groups.size())
+    return NULL;
+  std::lock_guard<std::mutex> lock(kdc.shared.groups_mutex);
+  std::unique_ptr<DH::Group>& group = groups[principal->group];
+  if (!group) {
+    DH::Number P, G;
+    if (!kdc.registry->group(principal->group, P, G))
+      return NULL;
+    const char* problem = DH::Group::check(P, G);
+    if (problem != NULL) {
+      std::cerr << "ERROR: group " << principal->group << " in the registry is damaged: "
+                << problem << "\n";
+      return NULL;
+    }
+    group.reset(new DH::Group(P, G));
+    group->precompute();
+  }
+  return group.get();
+}
 
-  // send generated key to user
-  long long generated_key = (long long)pow(G, private_key) % P;
-  server.send("127.0.0.1", port, std::to_string(generated_key));
+// ----------------------------------------------------------------------------
+// what a handshake knows about who its client is, from the registry if
+// there is one
+void identify(Handshake& handshake, const DH::Principal* principal) {
+  if (principal == NULL) {
+    handshake.name.clear();
+    handshake.record = 0;
+    handshake.has_key = false;
+    return;
+  }
+  handshake.name.assign(principal->name, principal->name_length);
+  handshake.record = principal->record;
+  handshake.has_key = principal->has_key;
+  handshake.registered_key = principal->key;
+}
+
+// ----------------------------------------------------------------------------
+// a client that registered a key has to pair with that one
+bool matches_registry(const Handshake& handshake) {
+  return !handshake.has_key || handshake.private_key == handshake.registered_key;
+}
+
+// ----------------------------------------------------------------------------
+void transmit(Kdc& kdc, Handshake& handshake) {
+  if (handshake.frames.size() == 1) {
+    const std::string& frame = handshake.frames[0];
+    kdc.server.send(handshake.client, frame.data(), frame.size());
+  } else {
+    std::vector<UDP::Datagram> batch(handshake.frames.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i].payload = handshake.frames[i];
+      batch[i].address = handshake.client;
+    }
+    kdc.server.sendBatch(batch);
+  }
+  handshake.deadline = Clock::now() + kdc.transport.rto(handshake.client);
+}
+
+// ----------------------------------------------------------------------------
+// send the frames of a request, resent by retransmit() until the client
+// acknowledges the last one
+void send_request(Kdc& kdc, Handshake& handshake) {
+  UDP::Frame last;
+  UDP::parseFrame(handshake.frames.back(), last);
+  handshake.reply_session = last.header.session;
+  handshake.reply_sequence = last.header.sequence;
+  handshake.attempts = 1;
+  handshake.sent = Clock::now();
+  transmit(kdc, handshake);
+}
+
+// ----------------------------------------------------------------------------
+// run task on the shard kdc, which owns whatever the task touches
+void post(Kdc& kdc, std::function<void(Kdc&)> task) {
+  {
+    std::lock_guard<std::mutex> lock(kdc.inbox_mutex);
+    kdc.inbox.push_back(std::move(task));
+  }
+  uint64_t one = 1;
+  if (write(kdc.wakeup, &one, sizeof one) < 0)
+    std::cerr << "ERROR: " << strerror(errno) << "\nwrite() failed" << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+// Take a ready handshake out of the pairing table. false if a peer has
+// claimed it already, and the handshake is about to be paired
+bool withdraw(Kdc& kdc, const Handshake& handshake) {
+  std::lock_guard<std::mutex> lock(kdc.shared.ready_mutex);
+  std::unordered_map<uint64_t, Waiting>::iterator it =
+      kdc.shared.ready.find(endpoint_key(handshake.client));
+  if (it == kdc.shared.ready.end() || it->second.handshake.session != handshake.session)
+    return false;
+  kdc.shared.ready.erase(it);
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+void diffie_hellman(Kdc& kdc, const UDP::Frame& frame, const struct sockaddr_in& from) {
+  // The trailer is read from the back: the role, the peer's port and the
+  // length of the client's name, which comes before it. The role, or with a
+  // registry the name, tells the group, and the group the width of the value
+  if (frame.length < UDP::kDhRequestTrailer) {
+    std::cerr << "ERROR: dropped a malformed connection request\n";
+    return;
+  }
+  uint8_t last = frame.payload[frame.length - 1];
+  size_t trailer = frame.length - UDP::kDhRequestTrailer;
+  if ((last != static_cast<uint8_t>(UDP::Role::kInitiator) &&
+       last != static_cast<uint8_t>(UDP::Role::kResponder)) ||
+      frame.payload[trailer] > trailer) {
+    std::cerr << "ERROR: dropped a malformed connection request\n";
+    return;
+  }
+  UDP::Role role = static_cast<UDP::Role>(last);
+  size_t name_length = frame.payload[trailer];
+  const char* name = reinterpret_cast<const char*>(frame.payload + trailer - name_length);
+  DH::Principal principal;
+  const DH::Group* group = find_group(kdc, role, name, name_length, &principal);
+  if (group == NULL) {
+    std::cerr << "ERROR: dropped a connection request from unknown principal "
+              << std::string(name, name_length) << "\n";
+    return;
+  }
+  size_t width = group->width();
+  if (trailer - name_length != width) {
+    std::cerr << "ERROR: dropped a malformed connection request\n";
+    return;
+  }
+  DH::Number received_key = DH::Number::fromBytes(frame.payload, width);
+  if (!group->acceptable(received_key)) {
+    std::cerr << "ERROR: dropped a malformed connection request\n";
+    return;
+  }
+
+  // a client that starts over from the same endpoint, with a new session,
+  // replaces its old handshake. The same session again is a retransmission
+  // that has fallen out of the transport's memory: answer it again
+  uint64_t key = endpoint_key(from);
+  std::unordered_map<uint64_t, Handshake>::iterator it = kdc.handshakes.find(key);
+  if (it != kdc.handshakes.end() && it->second.session == frame.header.session) {
+    const std::vector<uint8_t>& payload = it->second.public_value;
+    kdc.transport.reply(from, frame.header, UDP::MessageType::kDhPublic, payload.data(),
+                        payload.size());
+    return;
+  }
+  if (it == kdc.handshakes.end() && kdc.handshakes.size() >= kdc.settings.max_sessions) {
+    // not admitted, so that the retransmission gets another chance
+    std::cerr << "ERROR: too many handshakes, ignored a connection request\n";
+    return;
+  }
+  if (it != kdc.handshakes.end() && it->second.stage == Stage::kReady)
+    withdraw(kdc, it->second);
+  kdc.transport.admit(frame.header, from);
+  Handshake& handshake = kdc.handshakes[key];
+
+  // a fresh exponent for every handshake, G raised to it from the comb.
+  // Send generated key to user, again whenever the request is resent
+  DH::Number private_key, generated_key;
+  group->generate(private_key, generated_key);
+  handshake.public_value.resize(width);
+  generated_key.toBytes(handshake.public_value.data(), width);
+  kdc.transport.reply(from, frame.header, UDP::MessageType::kDhPublic,
+                      handshake.public_value.data(), width);
 
   // compute session key
-  long long session_key = (long long)pow(received_key, private_key) % P;
+  DH::Number secret = group->pow(received_key, private_key);
 
   // strip off all but last ten bits
+  uint64_t session_key = secret.low();
   session_key &= 0x3FF;
   session_key ^= 0x3FF;
 
-  return static_cast<uint16_t>(session_key);
+  handshake.client = from;
+  handshake.session = frame.header.session;
+  handshake.role = role;
+  identify(handshake, kdc.registry != NULL ? &principal : NULL);
+  handshake.peer_port = UDP::getU16(frame.payload + trailer + 1);
+  handshake.session_key = static_cast<uint16_t>(session_key);
+  handshake.heard = Clock::now();
+  std::cout << "\nKDC: The session key with " << handshake
+            << " is " << handshake.session_key << std::endl;
+
+  // prompt the user to send the key for the communication with the peer
+  std::string msg = role == UDP::Role::kInitiator
+      ? "Hello Thor,provide secret key you wish to pair with Iron Man"
+        " to start communication with him (3-digit hex):"
+      : "Hello Iron Man, Thor wants to communicate. Please input the secret key"
+        " you wish to use (3-digit hex):";
+  DES::KeyBank::instance().cipher(handshake.session_key).encrypt(msg);
+  handshake.frames.resize(1);
+  UDP::buildFrame(handshake.frames[0], UDP::MessageType::kKeyPrompt, handshake.session,
+                  kdc.transport.sequence(), msg.data(), msg.size());
+  handshake.stage = Stage::kPrompting;
+  send_request(kdc, handshake);
+}
+
+// ----------------------------------------------------------------------------
+void initialize_needham_schroeder(Kdc& kdc, Handshake& alice, const Handshake& bob) {
+  std::cout << "\nInitializing the Needham-Schroeder Protocol for " << alice
+            << " and " << bob << "\n";
+
+  // generate a "random" session key for alice and bob
+  uint16_t client_session_key = bob.session_key ^ alice.session_key;
+  std::cout << "Session key for Thor and Iron Man: " << client_session_key << "\n";
+
+  // Thor and Iron Man talk in a session of their own
+  std::random_device random;
+  uint32_t session;
+  do {
+    session = random();
+  } while (session == UDP::kAnySession);
+
+  // all three messages go to Alice, so they leave in a single batch:
+  // her copy of the session key, Bob's copy, and Bob's timestamp. She
+  // acknowledges the last one, once she has all of them
+  alice.frames.resize(3);
+
+  // the session key for Alice, encrypted with her private key
+  DES::KeyBank& bank = DES::KeyBank::instance();
+  DES::CipherHandle cipher_alice = bank.cipher(alice.private_key);
+  uint8_t payload[8];
+  UDP::putU16(payload, client_session_key);
+  cipher_alice.encrypt(payload, 2);
+  UDP::buildFrame(alice.frames[0], UDP::MessageType::kSessionKey, session,
+                  kdc.transport.sequence(), payload, 2);
+
+  // another session key for Alice to forward, encrypted with Bob's private key
+  DES::CipherHandle cipher_bob = bank.cipher(bob.private_key);
+  UDP::putU16(payload, client_session_key);
+  cipher_bob.encrypt(payload, 2);
+  UDP::buildFrame(alice.frames[1], UDP::MessageType::kTicket, session,
+                  kdc.transport.sequence(), payload, 2);
+
+  // and a timestamp for Bob
+  using namespace std::chrono;
+  milliseconds ms = duration_cast< milliseconds >(system_clock::now().time_since_epoch());
+  unsigned long long timestamp = ms.count();
+  UDP::putU64(payload, timestamp);
+  cipher_bob.encrypt(payload, 8);
+  UDP::buildFrame(alice.frames[2], UDP::MessageType::kTimestamp, session,
+                  kdc.transport.sequence(), payload, 8);
+
+  std::cout << "Timestamp: " << timestamp << std::endl;
+  alice.stage = Stage::kIssuing;
+  send_request(kdc, alice);
 }
 
+// ----------------------------------------------------------------------------
+// on the responder's shard, once the initiator's has issued the session key
+void forget(Kdc& kdc, uint64_t key, uint32_t session) {
+  std::unordered_map<uint64_t, Handshake>::iterator it = kdc.handshakes.find(key);
+  if (it != kdc.handshakes.end() && it->second.session == session)
+    kdc.handshakes.erase(it);
+}
+
+void pair(Kdc& kdc, Handshake& handshake);
 
 // ----------------------------------------------------------------------------
-uint16_t secure_connection(UDP::Server& server, std::string& name, 
-                            int client_port, long long P, long long G) {
-  std::cout << "\nWaiting to receive a connection request from " << name << "\n";
-  uint16_t session_key = diffie_hellman(server, client_port, P, G);
-  std::cout << "KDC: The session key with " << name
-            << " is " << session_key << std::endl;
+// on the responder's shard, when the initiator it was paired with has
+// started over: wait for the next one, or pair with it if it is ready
+void repair(Kdc& kdc, uint64_t key, uint32_t session) {
+  std::unordered_map<uint64_t, Handshake>::iterator it = kdc.handshakes.find(key);
+  if (it != kdc.handshakes.end() && it->second.session == session &&
+      it->second.stage == Stage::kReady)
+    pair(kdc, it->second);
+}
 
-  return session_key;
+// ----------------------------------------------------------------------------
+// on the initiator's shard, once the responder has its private key in too.
+// The responder's shard keeps its handshake until this says what became of
+// the pairing
+void issue(Kdc& kdc, uint64_t key, uint32_t session, const Waiting& bob) {
+  Kdc& owner = *kdc.shared.shards[bob.shard];
+  uint64_t bob_key = endpoint_key(bob.handshake.client);
+  uint32_t bob_session = bob.handshake.session;
+  std::unordered_map<uint64_t, Handshake>::iterator it = kdc.handshakes.find(key);
+  if (it == kdc.handshakes.end() || it->second.session != session ||
+      it->second.stage != Stage::kReady) {
+    std::cerr << "ERROR: the initiator " << bob.handshake << " was paired with has started over"
+              << std::endl;
+    post(owner, [bob_key, bob_session](Kdc& shard) {
+      repair(shard, bob_key, bob_session);
+    });
+    return;
+  }
+  initialize_needham_schroeder(kdc, it->second, bob.handshake);
+  // Bob hears the rest from Alice
+  post(owner, [bob_key, bob_session](Kdc& shard) {
+    forget(shard, bob_key, bob_session);
+  });
 }
 
+// ----------------------------------------------------------------------------
+// Once both ends of a pair have their private keys in, issue the session
+// key. The first to get there waits in the pairing table; the second takes
+// it out again and has the initiator's shard issue
+void pair(Kdc& kdc, Handshake& handshake) {
+  struct sockaddr_in peer_address = handshake.client;
+  peer_address.sin_port = htons(static_cast<uint16_t>(handshake.peer_port));
+  Waiting peer;
+  {
+    std::lock_guard<std::mutex> lock(kdc.shared.ready_mutex);
+    std::unordered_map<uint64_t, Waiting>::iterator it =
+        kdc.shared.ready.find(endpoint_key(peer_address));
+    if (it == kdc.shared.ready.end() || it->second.handshake.role == handshake.role ||
+        it->second.handshake.peer_port != ntohs(handshake.client.sin_port)) {
+      Waiting& waiting = kdc.shared.ready[endpoint_key(handshake.client)];
+      waiting.shard = kdc.index;
+      waiting.handshake = handshake;
+      return;
+    }
+    peer = std::move(it->second);
+    kdc.shared.ready.erase(it);
+  }
+
+  Kdc& owner = *kdc.shared.shards[peer.shard];
+  uint64_t peer_key = endpoint_key(peer.handshake.client);
+  uint32_t peer_session = peer.handshake.session;
+  if (handshake.role == UDP::Role::kInitiator) {
+    initialize_needham_schroeder(kdc, handshake, peer.handshake);
+    // Bob hears the rest from Alice
+    post(owner, [peer_key, peer_session](Kdc& shard) {
+      forget(shard, peer_key, peer_session);
+    });
+    return;
+  }
+  // out of the table but still kReady, so it is not dismissed meanwhile
+  Waiting bob;
+  bob.shard = kdc.index;
+  bob.handshake = handshake;
+  post(owner, [peer_key, peer_session, bob](Kdc& shard) {
+    issue(shard, peer_key, peer_session, bob);
+  });
+}
 
 // ----------------------------------------------------------------------------
-uint16_t prompt_user_and_receive_key(UDP::Server& server, DES::Cipher& cipher, 
-                                      std::string& msg, int client_port, 
-                                      std::string& name) {
+// A client waiting for its peer waits for the frame the pairing would send
+// it first, the session key or the ticket. The same frame, empty, tells it
+// that the peer did not come
+void dismiss(Kdc& kdc, Handshake& handshake) {
+  std::cout << "Gave up on " << handshake << ", its peer did not come" << std::endl;
+  UDP::MessageType type = handshake.role == UDP::Role::kInitiator
+      ? UDP::MessageType::kSessionKey : UDP::MessageType::kTicket;
+  handshake.frames.resize(1);
+  UDP::buildFrame(handshake.frames[0], type, handshake.session, kdc.transport.sequence(),
+                  NULL, 0);
+  handshake.stage = Stage::kDismissing;
+  send_request(kdc, handshake);
+}
 
-  std::string encrypted;
-  cipher.encrypt(msg, encrypted);
-  // for (char c : msg)
-  //   encrypted += cipher.encrypt(c);
-  server.send("127.0.0.1", client_port, encrypted);
+// ----------------------------------------------------------------------------
+// the reply to a private key: the client's resumption ticket, under the
+// session key
+void send_resumption(Kdc& kdc, const Handshake& handshake, const UDP::FrameHeader& request) {
+  uint8_t payload[UDP::kResumptionSize];
+  UDP::putU64(payload, handshake.ticket);
+  UDP::putU32(payload + 8, static_cast<uint32_t>(kdc.cache.ttl().count()));
+  DES::KeyBank::instance().cipher(handshake.session_key).encrypt(payload, sizeof(payload));
+  kdc.transport.reply(handshake.client, request, UDP::MessageType::kResumption, payload,
+                      sizeof(payload));
+}
 
-  // receive user's (encrypted) private key
-  std::string buffer;
-  server.receive(buffer);
-  std::string decrypted;
-  cipher.decrypt(buffer, decrypted);
-  // for (char c : buffer)
-  //   decrypted += cipher.decrypt(c);
+// ----------------------------------------------------------------------------
+void receive_private_key(Kdc& kdc, const UDP::Frame& frame, const struct sockaddr_in& from) {
+  std::unordered_map<uint64_t, Handshake>::iterator it =
+      kdc.handshakes.find(endpoint_key(from));
+  if (it == kdc.handshakes.end() || it->second.session != frame.header.session ||
+      frame.length != 2) {
+    std::cerr << "ERROR: dropped a private key from outside any handshake\n";
+    return;
+  }
+  Handshake& handshake = it->second;
+  handshake.heard = Clock::now();
+  kdc.transport.admit(frame.header, from);
+  if (handshake.stage != Stage::kPrompting && handshake.stage != Stage::kPrompted) {
+    // already have it, the reply got lost
+    send_resumption(kdc, handshake, frame.header);
+    return;
+  }
 
-  std::cout << "Received private key from " << name << std::endl;
-  uint16_t private_key = std::stoi(decrypted, nullptr, 16);
-  return private_key;
+  // the key is the answer to the prompt, whether its acknowledgement made
+  // it or not
+  uint8_t key[2];
+  DES::KeyBank::instance().cipher(handshake.session_key).decrypt(frame.payload, key,
+                                                                 sizeof(key));
+  handshake.private_key = UDP::getU16(key);
+  if (!matches_registry(handshake)) {
+    std::cerr << "ERROR: the private key of " << handshake
+              << " is not the one it registered, gave up on it" << std::endl;
+    kdc.handshakes.erase(it);
+    return;
+  }
+
+  // the session key is good for another round, for as long as the cache
+  // keeps it
+  std::random_device random;
+  do {
+    handshake.ticket = (static_cast<uint64_t>(random()) << 32) | random();
+  } while (handshake.ticket == 0);
+  DH::CachedSession cached;
+  cached.principal = endpoint_key(from);
+  cached.record = handshake.record;
+  cached.role = static_cast<uint8_t>(handshake.role);
+  cached.session_key = handshake.session_key;
+  kdc.cache.insert(handshake.ticket, cached);
+  send_resumption(kdc, handshake, frame.header);
+  handshake.frames.clear();
+  handshake.stage = Stage::kReady;
+  std::cout << "Received private key from " << handshake << std::endl;
+
+  pair(kdc, handshake);
 }
 
 // ----------------------------------------------------------------------------
-void initialize_needham_schroeder(UDP::Server& server, uint16_t client_session_key, 
-                                  uint16_t private_key_alice, int port_alice,
-                                  uint16_t private_key_bob) {
+// A returning client: the ticket for a session key agreed on before and its
+// private key under that key. One round trip takes it as far as the
+// exchange, the prompt and the private key would have, or tells it to start
+// over if the ticket is unknown, has expired or is not the sender's
+void resume(Kdc& kdc, const UDP::Frame& frame, const struct sockaddr_in& from) {
+  if (frame.length != UDP::kResumeRequestSize) {
+    std::cerr << "ERROR: dropped a malformed resumption request\n";
+    return;
+  }
 
-  std::string key_string = std::to_string(client_session_key);
-  
-  // send the session key to Alice, encrypted with her private key
-  DES::Cipher cipher_alice(private_key_alice);
-  std::string encrypted;
-  cipher_alice.encrypt(key_string, encrypted);
+  // the same session again is a retransmission that has fallen out of the
+  // transport's memory, just like with a connection request
+  uint64_t key = endpoint_key(from);
+  std::unordered_map<uint64_t, Handshake>::iterator it = kdc.handshakes.find(key);
+  uint8_t resumed = 1;
+  if (it != kdc.handshakes.end() && it->second.session == frame.header.session) {
+    kdc.transport.reply(from, frame.header, UDP::MessageType::kResume, &resumed, 1);
+    return;
+  }
+  if (it == kdc.handshakes.end() && kdc.handshakes.size() >= kdc.settings.max_sessions) {
+    std::cerr << "ERROR: too many handshakes, ignored a resumption request\n";
+    return;
+  }
+  if (it != kdc.handshakes.end() && it->second.stage == Stage::kReady)
+    withdraw(kdc, it->second);
+  kdc.transport.admit(frame.header, from);
+
+  uint64_t ticket = UDP::getU64(frame.payload);
+  uint8_t role = frame.payload[UDP::kResumeRequestSize - 1];
+  DH::CachedSession cached;
+  DH::Principal principal;
+  bool known = kdc.cache.find(ticket, cached) && cached.principal == key &&
+               cached.role == role &&
+               (kdc.registry == NULL || kdc.registry->at(cached.record, principal));
+  uint8_t private_key[2];
+  if (known) {
+    DES::KeyBank::instance().cipher(cached.session_key).decrypt(frame.payload + 8, private_key,
+                                                                sizeof(private_key));
+    // a key other than the registered one gets no further than the ticket
+    known = kdc.registry == NULL || !principal.has_key ||
+            principal.key == UDP::getU16(private_key);
+  }
+  if (!known) {
+    resumed = 0;
+    kdc.transport.reply(from, frame.header, UDP::MessageType::kResume, &resumed, 1);
+    std::cout << "\nKDC: Could not resume a session with " << inet_ntoa(from.sin_addr) << ":"
+              << ntohs(from.sin_port) << ", it has to start over" << std::endl;
+    return;
+  }
+  kdc.transport.reply(from, frame.header, UDP::MessageType::kResume, &resumed, 1);
+
+  Handshake& handshake = kdc.handshakes[key];
+  handshake.client = from;
+  handshake.session = frame.header.session;
+  handshake.role = static_cast<UDP::Role>(role);
+  identify(handshake, kdc.registry != NULL ? &principal : NULL);
+  handshake.peer_port = UDP::getU16(frame.payload + 10);
+  handshake.public_value.clear();
+  handshake.session_key = cached.session_key;
+  handshake.private_key = UDP::getU16(private_key);
+  handshake.ticket = ticket;
+  handshake.heard = Clock::now();
+  handshake.frames.clear();
+  handshake.stage = Stage::kReady;
+  std::cout << "\nKDC: Resumed the session with " << handshake
+            << ", session key " << handshake.session_key << std::endl;
+  std::cout << "Received private key from " << handshake << std::endl;
+
+  pair(kdc, handshake);
+}
 
-  server.send("127.0.0.1", port_alice, encrypted);
+// ----------------------------------------------------------------------------
+void receive_ack(Kdc& kdc, const UDP::Frame& frame, const struct sockaddr_in& from) {
+  std::unordered_map<uint64_t, Handshake>::iterator it =
+      kdc.handshakes.find(endpoint_key(from));
+  if (it == kdc.handshakes.end() || it->second.frames.empty() ||
+      frame.header.session != it->second.reply_session ||
+      frame.header.sequence != it->second.reply_sequence)
+    return; // late, or a duplicate of one we already had
+
+  Handshake& handshake = it->second;
+  handshake.heard = Clock::now();
+  handshake.frames.clear();
+  // Karn: a reply to a resent request could belong to either copy
+  if (handshake.attempts == 1)
+    kdc.transport.sample(from, Clock::now() - handshake.sent);
+
+  if (handshake.stage == Stage::kPrompting) {
+    handshake.stage = Stage::kPrompted;
+    return;
+  }
+  if (handshake.stage == Stage::kDismissing) {
+    kdc.handshakes.erase(it);
+    return;
+  }
 
-  // send another session key to Alice, encrypted with Bob's private key
-  DES::Cipher cipher_bob(private_key_bob);
-  cipher_bob.encrypt(key_string, encrypted);
+  ++kdc.shared.pairs;
+  std::cout << "Thor and Iron Man can now securely communicate.";
+  if (!kdc.settings.serve) {
+    // once the server initializes the Needham-Schroeder Protocol, it is no
+    // longer needed
+    std::cout << " Shutting down.";
+    for (Kdc* shard : kdc.shared.shards)
+      post(*shard, [](Kdc& stopping) { stopping.reactor.stop(); });
+  }
+  std::cout << std::endl;
+  kdc.handshakes.erase(it);
+}
 
-  // send Bob's key and a timestamp
-  using namespace std::chrono;
-  milliseconds ms = duration_cast< milliseconds >(system_clock::now().time_since_epoch());
-  unsigned long long timestamp = ms.count();
-  std::string str_timestamp;
-  cipher_bob.encrypt(std::to_string(timestamp), str_timestamp);
+// ----------------------------------------------------------------------------
+// resend what has not been acknowledged in time, forget about clients that
+// have gone quiet and tell the ones whose peer never came
+void retransmit(Kdc& kdc) {
+  Clock::time_point now = Clock::now();
+  std::unordered_map<uint64_t, Handshake>::iterator it = kdc.handshakes.begin();
+  while (it != kdc.handshakes.end()) {
+    Handshake& handshake = it->second;
+    if (!handshake.frames.empty() && now >= handshake.deadline) {
+      if (handshake.attempts == kdc.transport.options().max_attempts) {
+        std::cerr << "ERROR: no reply from " << handshake << " after "
+                  << handshake.attempts << " attempts" << std::endl;
+        it = kdc.handshakes.erase(it);
+        continue;
+      }
+      kdc.transport.backOff(handshake.client);
+      ++handshake.attempts;
+      transmit(kdc, handshake);
+    } else if (handshake.stage == Stage::kReady) {
+      // the client is waiting rather than quiet. One that a peer has just
+      // claimed is about to be paired
+      if (now - handshake.heard > kdc.settings.pairing && withdraw(kdc, handshake))
+        dismiss(kdc, handshake);
+    } else if (handshake.frames.empty() && now - handshake.heard > kdc.settings.idle) {
+      // one that is sent something is given up on by the retransmissions
+      std::cout << "Gave up on " << handshake << ", idle for too long" << std::endl;
+      it = kdc.handshakes.erase(it);
+      continue;
+    }
+    ++it;
+  }
+}
 
-  std::cout << "Timestamp: " << timestamp << std::endl;
-  server.send("127.0.0.1", port_alice, encrypted);
-  server.send("127.0.0.1", port_alice, str_timestamp);
+// ----------------------------------------------------------------------------
+// serve handshakes, any number at a time and in any order, until the first
+// pair is done or, with --serve, for good
+void serve(Kdc& kdc) {
+  std::vector<uint8_t> landing(UDP::kMaxBuffer);
+  UDP::Buffer buffer;
+  buffer.data = landing.data();
+  buffer.capacity = landing.size();
+
+  // edge triggered, so take everything that is queued
+  kdc.server.setBlocking(false);
+  kdc.reactor.watch(kdc.server.getSocketDescriptor(), [&]() {
+    UDP::Frame frame;
+    while (kdc.server.receive(buffer) >= 0) {
+      if (!UDP::parseFrame(buffer.data, buffer.length, frame)) {
+        std::cerr << "ERROR: dropped a malformed message\n";
+        continue;
+      }
+      if (frame.header.type == UDP::MessageType::kAck) {
+        receive_ack(kdc, frame, buffer.address);
+        continue;
+      }
+      // requests seen before were answered already
+      if (kdc.transport.answer(frame.header, buffer.address))
+        continue;
+
+      if (frame.header.type == UDP::MessageType::kDhPublic)
+        diffie_hellman(kdc, frame, buffer.address);
+      else if (frame.header.type == UDP::MessageType::kPrivateKey)
+        receive_private_key(kdc, frame, buffer.address);
+      else if (frame.header.type == UDP::MessageType::kResume)
+        resume(kdc, frame, buffer.address);
+      else
+        std::cerr << "ERROR: dropped a message the KDC does not handle\n";
+    }
+  });
+
+  // what other shards hand over
+  kdc.reactor.watch(kdc.wakeup, [&]() {
+    uint64_t count;
+    while (read(kdc.wakeup, &count, sizeof count) > 0) {
+    }
+    std::vector<std::function<void(Kdc&)>> tasks;
+    {
+      std::lock_guard<std::mutex> lock(kdc.inbox_mutex);
+      tasks.swap(kdc.inbox);
+    }
+    for (std::function<void(Kdc&)>& task : tasks)
+      task(kdc);
+  });
+
+  // the finest retransmission timer there can be is also often enough to
+  // look for idle clients
+  kdc.reactor.addTimer(kdc.transport.options().min_rto, [&]() {
+    retransmit(kdc);
+  });
+
+  kdc.reactor.run();
 }
 
 
 
 // ============================================================================
 int main(int argc, char** argv) {
-  validate_input(argc, argv);
-
-  // read alice and bob's public info
-  long long P_alice, G_alice, P_bob, G_bob;
-  read_public_info(argv, &P_alice, &G_alice, &P_bob, &G_bob);
+  Settings settings;
+  validate_input(argc, argv, &settings);
 
-  // start server
+  // start the server, one socket per shard on the same port. Every
+  // handshake remembers two requests of its client
   int port = 5000;
-  int port_alice = 5001;
-  int port_bob = 5002;
   std::string host = "127.0.0.1";
-  UDP::Server server(host, port);
-
-  // establish a secure connection with Alice
-  std::string name = "Thor";
-  uint16_t session_key_alice = secure_connection(server, name, port_alice,
-                                                  P_alice, G_alice);
-  
-  // prompt Alice to send the key for her communication with Bob
-  DES::Cipher cipher_alice(session_key_alice);
-  std::string msg = "Hello Thor,provide secret key you wish to pair with Iron Man"
-                    " to start communication with him (3-digit hex):";
-  uint16_t private_key_alice = prompt_user_and_receive_key(server, cipher_alice,
-                                                            msg, port_alice, name);
-
-  // establish a secure connection with Bob
-  name = "Iron Man";
-  uint16_t session_key_bob = secure_connection(server, name, port_bob, P_bob, G_bob);
-
-  // Prompt Bob to send a private key to talk to Alice
-  DES::Cipher cipher_bob(session_key_bob);
-  msg = "Hello Iron Man, Thor wants to communicate. Please input the secret key"
-        " you wish to use (3-digit hex):";
-  uint16_t private_key_bob = prompt_user_and_receive_key(server, cipher_bob, 
-                                                          msg, port_bob, name);
-
-  // --------- DIFFIE-HELLMAN COMPLETE; BEGIN NEEDHAM SCHROEDER --------- //
-  std::cout << "\nInitializing the Needham-Schroeder Protocol\n";
+  UDP::ShardedServer servers(host, port, settings.shards);
+  size_t count = servers.size();
+  Settings shard_settings = settings;
+  shard_settings.max_sessions = (settings.max_sessions + count - 1) / count;
+  shard_settings.cache_memory = settings.cache_memory / count;
+  UDP::TransportOptions options;
+  options.remembered = 2 * shard_settings.max_sessions;
+
+  // Map the registry, which is all there is to do for it up front, or read
+  // alice and bob's public info. Every handshake raises G to a new
+  // exponent, so G gets its comb as soon as it is known
+  std::unique_ptr<DH::Registry> registry;
+  if (settings.registry != NULL) {
+    registry.reset(new DH::Registry(settings.registry));
+    std::cout << "Registry " << settings.registry << ": " << registry->principals()
+              << " principals in " << registry->groups() << " groups" << std::endl;
+  }
+  Shared shared(registry.get());
+  if (registry) {
+    shared.groups.resize(registry->groups());
+  } else {
+    DH::Number P_alice, G_alice, P_bob, G_bob;
+    read_public_info(argv, &P_alice, &G_alice, &P_bob, &G_bob);
+    shared.groups.emplace_back(new DH::Group(P_alice, G_alice));
+    shared.groups.emplace_back(new DH::Group(P_bob, G_bob));
+    for (std::unique_ptr<DH::Group>& group : shared.groups)
+      group->precompute();
+  }
 
-  // generate a "random" session key for alice and bob
-  uint16_t client_session_key = session_key_bob ^ session_key_alice;
-  std::cout << "Session key for Thor and Iron Man: " << client_session_key << "\n";
+  std::vector<std::unique_ptr<Kdc>> shards;
+  for (size_t i = 0; i < count; ++i) {
+    shards.emplace_back(new Kdc(shared, i, servers.shard(i), shard_settings, options));
+    shared.shards.push_back(shards.back().get());
+  }
 
-  // once the server initializes the Needham-Schroeder Protocol, it is no longer needed
-  initialize_needham_schroeder(server, client_session_key, private_key_alice, 
-                                port_alice, private_key_bob);
-  std::cout << "Thor and Iron Man can now securely communicate. Shutting down.\n";
+  std::cout << "\nWaiting to receive connection requests on port " << port << ", "
+            << count << (count == 1 ? " shard" : " shards") << std::endl;
+  servers.start([&](UDP::Server&, size_t index) {
+    Kdc& kdc = *shards[index];
+    serve(kdc);
+    // Iron Man may not have heard that his key arrived
+    kdc.transport.linger(kdc.transport.options().max_rto);
+  });
+  servers.join();
 
   return EXIT_SUCCESS;
 }
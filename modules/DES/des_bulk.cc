@@ -0,0 +1,173 @@
+#include "des_bulk.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DES_BULK_X86 1
+#include <immintrin.h>
+#endif
+
+namespace DES {
+namespace {
+
+// ----------------------------------------------------------------------------
+void substituteScalar(const uint8_t* table, const uint8_t* in, uint8_t* out,
+                      size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    out[i] = table[in[i]];
+}
+
+#ifdef DES_BULK_X86
+// The 256-byte table is split into 16 rows of 16 entries, one per high nibble.
+// Row h is a pshufb lookup on the low nibble of (x - 16h). Adding 0x70 with
+// unsigned saturation sets bit 7 in every lane whose high nibble was not h,
+// and pshufb writes zero for those lanes, so OR-ing the 16 rows gives the
+// table entry. Two vectors are kept in flight to hide the shuffle latency.
+
+// ----------------------------------------------------------------------------
+__attribute__((target("ssse3")))
+void substituteSSSE3(const uint8_t* table, const uint8_t* in, uint8_t* out,
+                     size_t n) {
+  __m128i rows[16];
+  for (int h = 0; h < 16; ++h)
+    rows[h] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16 * h));
+
+  const __m128i bias = _mm_set1_epi8(0x70);
+  const __m128i step = _mm_set1_epi8(0x10);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 16));
+    __m128i result_a = _mm_shuffle_epi8(rows[0], _mm_adds_epu8(a, bias));
+    __m128i result_b = _mm_shuffle_epi8(rows[0], _mm_adds_epu8(b, bias));
+    for (int h = 1; h < 16; ++h) {
+      a = _mm_sub_epi8(a, step);
+      b = _mm_sub_epi8(b, step);
+      result_a = _mm_or_si128(result_a, _mm_shuffle_epi8(rows[h], _mm_adds_epu8(a, bias)));
+      result_b = _mm_or_si128(result_b, _mm_shuffle_epi8(rows[h], _mm_adds_epu8(b, bias)));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), result_a);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 16), result_b);
+  }
+  substituteScalar(table, in + i, out + i, n - i);
+}
+
+// ----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+void substituteAVX2(const uint8_t* table, const uint8_t* in, uint8_t* out,
+                    size_t n) {
+  // vpshufb works within each 128-bit lane, so every row goes in both lanes
+  __m256i rows[16];
+  for (int h = 0; h < 16; ++h) {
+    __m128i row = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16 * h));
+    rows[h] = _mm256_broadcastsi128_si256(row);
+  }
+
+  const __m256i bias = _mm256_set1_epi8(0x70);
+  const __m256i step = _mm256_set1_epi8(0x10);
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 32));
+    __m256i result_a = _mm256_shuffle_epi8(rows[0], _mm256_adds_epu8(a, bias));
+    __m256i result_b = _mm256_shuffle_epi8(rows[0], _mm256_adds_epu8(b, bias));
+    for (int h = 1; h < 16; ++h) {
+      a = _mm256_sub_epi8(a, step);
+      b = _mm256_sub_epi8(b, step);
+      result_a = _mm256_or_si256(result_a, _mm256_shuffle_epi8(rows[h], _mm256_adds_epu8(a, bias)));
+      result_b = _mm256_or_si256(result_b, _mm256_shuffle_epi8(rows[h], _mm256_adds_epu8(b, bias)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), result_a);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 32), result_b);
+  }
+  substituteSSSE3(table, in + i, out + i, n - i);
+}
+
+// ----------------------------------------------------------------------------
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+void substituteVBMI(const uint8_t* table, const uint8_t* in, uint8_t* out,
+                    size_t n) {
+  // vpermi2b indexes 128 bytes with the low 7 bits, so two lookups cover the
+  // whole table and bit 7 picks between them
+  const __m512i t0 = _mm512_loadu_si512(table);
+  const __m512i t1 = _mm512_loadu_si512(table + 64);
+  const __m512i t2 = _mm512_loadu_si512(table + 128);
+  const __m512i t3 = _mm512_loadu_si512(table + 192);
+
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    __m512i x = _mm512_loadu_si512(in + i);
+    __m512i low_half = _mm512_permutex2var_epi8(t0, x, t1);
+    __m512i high_half = _mm512_permutex2var_epi8(t2, x, t3);
+    __mmask64 high = _mm512_movepi8_mask(x);
+    _mm512_storeu_si512(out + i, _mm512_mask_blend_epi8(high, low_half, high_half));
+  }
+  substituteAVX2(table, in + i, out + i, n - i);
+}
+#endif // DES_BULK_X86
+
+// ----------------------------------------------------------------------------
+Kernel detectKernel() {
+#ifdef DES_BULK_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+      && __builtin_cpu_supports("avx512vbmi"))
+    return Kernel::kAVX512VBMI;
+  if (__builtin_cpu_supports("avx2"))
+    return Kernel::kAVX2;
+  if (__builtin_cpu_supports("ssse3"))
+    return Kernel::kSSSE3;
+#endif
+  return Kernel::kScalar;
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+Kernel activeKernel() {
+  static const Kernel kernel = detectKernel();
+  return kernel;
+}
+
+// ----------------------------------------------------------------------------
+const char* kernelName(Kernel kernel) {
+  switch (kernel) {
+    case Kernel::kSSSE3: return "ssse3";
+    case Kernel::kAVX2:  return "avx2";
+    case Kernel::kAVX512VBMI: return "avx512vbmi";
+    default:             return "scalar";
+  }
+}
+
+// ----------------------------------------------------------------------------
+void substitute(const uint8_t* table, const uint8_t* in, uint8_t* out, size_t n) {
+  substitute(activeKernel(), table, in, out, n);
+}
+
+// ----------------------------------------------------------------------------
+void substitute(Kernel kernel, const uint8_t* table, const uint8_t* in,
+                uint8_t* out, size_t n) {
+#ifdef DES_BULK_X86
+  // never run a kernel the CPU cannot execute; the enumerators are ordered so
+  // that each one implies the ones before it
+  Kernel supported = activeKernel();
+  if (kernel > supported)
+    kernel = Kernel::kScalar;
+
+  if (kernel == Kernel::kAVX512VBMI) {
+    substituteVBMI(table, in, out, n);
+    return;
+  }
+  if (kernel == Kernel::kAVX2) {
+    substituteAVX2(table, in, out, n);
+    return;
+  }
+  if (kernel == Kernel::kSSSE3) {
+    substituteSSSE3(table, in, out, n);
+    return;
+  }
+#else
+  (void)kernel;
+#endif
+  substituteScalar(table, in, out, n);
+}
+
+} // namespace DES
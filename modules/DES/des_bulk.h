@@ -0,0 +1,31 @@
+#ifndef DES_BULK_H
+#define DES_BULK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DES {
+
+// Kernels that apply a 256-entry byte table to a buffer
+enum class Kernel {
+  kScalar,
+  kSSSE3,   // 16 bytes per step
+  kAVX2,        // 32 bytes per step
+  kAVX512VBMI   // 64 bytes per step
+};
+
+// Best kernel the running CPU supports, detected once
+Kernel activeKernel();
+const char* kernelName(Kernel kernel);
+
+// out[i] = table[in[i]] for i in [0, n). `in` and `out` may alias exactly.
+void substitute(const uint8_t* table, const uint8_t* in, uint8_t* out, size_t n);
+
+// Same, with an explicit kernel. Asking for one the CPU lacks falls back to
+// the scalar loop.
+void substitute(Kernel kernel, const uint8_t* table, const uint8_t* in,
+                uint8_t* out, size_t n);
+
+} // namespace DES
+
+#endif // DES_BULK_H
@@ -1,13 +1,39 @@
 #ifndef DES_CIPHER_H
 #define DES_CIPHER_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <string>
-#include <vector>
+
+#include "des_bulk.h"
+#include "des_tables.h"
 
 namespace DES {
 
+// Lightweight, copyable view of one key's tables. It does not own anything,
+// so it must not outlive what it points into (a Cipher, a FixedCipher's
+// static tables or the process-wide KeyBank).
+class CipherHandle {
+ public:
+  explicit CipherHandle(const Tables& tables_) : tables(&tables_) {}
+
+  uint8_t encrypt(uint8_t byte) const { return this->tables->encrypt[byte]; }
+  void encrypt(const std::string& plaintext, std::string& result) const;
+  void encrypt(const uint8_t* in, uint8_t* out, size_t n) const;
+  void encrypt(uint8_t* data, size_t n) const;
+  void encrypt(std::string& data) const;
+
+  uint8_t decrypt(uint8_t byte) const { return this->tables->decrypt[byte]; }
+  void decrypt(const std::string& ciphertext, std::string& result) const;
+  void decrypt(const uint8_t* in, uint8_t* out, size_t n) const;
+  void decrypt(uint8_t* data, size_t n) const;
+  void decrypt(std::string& data) const;
+
+ private:
+  const Tables* tables;
+};
+
 class Cipher {
  public:
   Cipher();
@@ -20,36 +46,107 @@ class Cipher {
   Cipher& operator=(const Cipher&) = delete;
   Cipher& operator=(Cipher&&) = delete;
 
-  // Encrypt and decrypt one byte at a time
-  uint8_t encrypt(uint8_t byte);
-  void encrypt(const std::string& plaintext, std::string& result);
-  uint8_t decrypt(uint8_t byte);
-  void decrypt(const std::string& ciphertext, std::string& result);
+  // Encrypt and decrypt one byte at a time. The buffer and string overloads
+  // are plain lookups into the per-key tables built by generateSubkeys()
+  uint8_t encrypt(uint8_t byte) const;
+  void encrypt(const std::string& plaintext, std::string& result) const;
+  uint8_t decrypt(uint8_t byte) const;
+  void decrypt(const std::string& ciphertext, std::string& result) const;
+
+  // Buffer overloads never allocate. `in` and `out` may be the same buffer,
+  // and the single-buffer and std::string& forms work in place.
+  void encrypt(const uint8_t* in, uint8_t* out, size_t n) const;
+  void encrypt(uint8_t* data, size_t n) const;
+  void encrypt(std::string& data) const;
+  void decrypt(const uint8_t* in, uint8_t* out, size_t n) const;
+  void decrypt(uint8_t* data, size_t n) const;
+  void decrypt(std::string& data) const;
+
+  CipherHandle handle() const { return CipherHandle(this->tables); }
 
  private:
   // methods ------------------------------------
   void generateSubkeys();
-  uint8_t feistel(uint8_t data, uint16_t key);
 
   // members ------------------------------------
-  uint16_t key = 0x2D7; // 0b1011010111
+  uint16_t key = kDefaultKey;
   uint16_t key1, key2;
-  const std::vector<std::vector<int>> S0 = {{1,0,3,2}, 
-                                            {3,2,1,0},
-                                            {0,2,1,3},
-                                            {3,1,3,2}};
 
-  const std::vector<std::vector<int>> S1 = {{0,1,2,3},
-                                            {2,0,1,3},
-                                            {3,0,1,0},
-                                            {2,1,0,3}};
+  // the block is only 8 bits wide, so each key fully defines both directions
+  Tables tables;
+};
+
+// Cipher for a key known at compile time. The tables are computed by the
+// compiler and live in read-only data, so there is no runtime setup at all.
+template <uint16_t Key>
+class FixedCipher {
+ public:
+  static constexpr uint16_t key = Key;
+
+  static constexpr uint8_t encrypt(uint8_t byte) { return kTables.encrypt[byte]; }
+  static void encrypt(const std::string& plaintext, std::string& result);
+  static constexpr uint8_t decrypt(uint8_t byte) { return kTables.decrypt[byte]; }
+  static void decrypt(const std::string& ciphertext, std::string& result);
 
+  static void encrypt(const uint8_t* in, uint8_t* out, size_t n);
+  static void encrypt(std::string& data);
+  static void decrypt(const uint8_t* in, uint8_t* out, size_t n);
+  static void decrypt(std::string& data);
+
+  static const Tables& tables() { return kTables; }
+  static CipherHandle handle() { return CipherHandle(kTables); }
+
+ private:
+  static constexpr Tables kTables = generateTables(Key);
 };
 
+using DefaultCipher = FixedCipher<kDefaultKey>;
+
+// Apply one direction of a table set to a string, used by both ciphers. The
+// out-of-place form sizes `out` once; the in-place form never allocates.
+void substitute(const uint8_t* table, const std::string& in, std::string& out);
+void substitute(const uint8_t* table, std::string& data);
+
+// ----------------------------------------------------------------------------
+template <uint16_t Key>
+constexpr Tables FixedCipher<Key>::kTables;
+
+// ----------------------------------------------------------------------------
+template <uint16_t Key>
+void FixedCipher<Key>::encrypt(const std::string& plaintext, std::string& result) {
+  substitute(kTables.encrypt, plaintext, result);
+}
+
+// ----------------------------------------------------------------------------
+template <uint16_t Key>
+void FixedCipher<Key>::decrypt(const std::string& ciphertext, std::string& result) {
+  substitute(kTables.decrypt, ciphertext, result);
 }
 
+// ----------------------------------------------------------------------------
+template <uint16_t Key>
+void FixedCipher<Key>::encrypt(const uint8_t* in, uint8_t* out, size_t n) {
+  substitute(kTables.encrypt, in, out, n);
+}
 
+// ----------------------------------------------------------------------------
+template <uint16_t Key>
+void FixedCipher<Key>::encrypt(std::string& data) {
+  substitute(kTables.encrypt, data);
+}
 
+// ----------------------------------------------------------------------------
+template <uint16_t Key>
+void FixedCipher<Key>::decrypt(const uint8_t* in, uint8_t* out, size_t n) {
+  substitute(kTables.decrypt, in, out, n);
+}
 
+// ----------------------------------------------------------------------------
+template <uint16_t Key>
+void FixedCipher<Key>::decrypt(std::string& data) {
+  substitute(kTables.decrypt, data);
+}
+
+}
 
-#endif // DES_CIPHER_H
\ No newline at end of file
+#endif // DES_CIPHER_H
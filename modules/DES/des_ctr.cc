@@ -0,0 +1,156 @@
+#include "des_ctr.h"
+
+#include <string.h>
+
+namespace DES {
+namespace {
+
+// one parallelFor job for the pooled generateKeystream
+struct KeystreamJob {
+  CipherHandle cipher;
+  uint64_t counter;
+  uint8_t* out;
+  size_t n;
+  size_t chunk;
+};
+
+// ----------------------------------------------------------------------------
+void runKeystreamChunk(void* context, size_t index) {
+  const KeystreamJob& job = *static_cast<const KeystreamJob*>(context);
+  size_t offset = index * job.chunk;
+  size_t length = job.n - offset < job.chunk ? job.n - offset : job.chunk;
+  generateKeystream(job.cipher, job.counter + offset, job.out + offset, length);
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+void generateKeystream(CipherHandle cipher, uint64_t counter, uint8_t* out, size_t n) {
+  while (n > 0) {
+    // chain the seven high bytes once for this run of low bytes
+    uint8_t prefix = 0;
+    for (int shift = 56; shift >= 8; shift -= 8)
+      prefix = cipher.encrypt(static_cast<uint8_t>(prefix ^ (counter >> shift)));
+
+    size_t low = counter & 0xFF;
+    size_t run = 256 - low < n ? 256 - low : n;
+    for (size_t i = 0; i < run; ++i)
+      out[i] = static_cast<uint8_t>(prefix ^ (low + i));
+    cipher.encrypt(out, run);
+
+    counter += run;
+    out += run;
+    n -= run;
+  }
+}
+
+// ----------------------------------------------------------------------------
+void generateKeystream(CipherHandle cipher, uint64_t counter, uint8_t* out, size_t n,
+                       WorkerPool& pool, size_t chunk) {
+  if (chunk == 0 || n <= chunk || pool.size() == 0) {
+    generateKeystream(cipher, counter, out, n);
+    return;
+  }
+
+  KeystreamJob job{cipher, counter, out, n, chunk};
+  pool.parallelFor((n + chunk - 1) / chunk, &runKeystreamChunk, &job);
+}
+
+// ----------------------------------------------------------------------------
+void applyKeystream(const uint8_t* keystream, const uint8_t* in, uint8_t* out, size_t n) {
+  // eight bytes per step; memcpy keeps it legal for unaligned and aliased
+  // buffers and compiles down to plain loads and stores
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t data, key;
+    memcpy(&data, in + i, 8);
+    memcpy(&key, keystream + i, 8);
+    data ^= key;
+    memcpy(out + i, &data, 8);
+  }
+  for (; i < n; ++i)
+    out[i] = in[i] ^ keystream[i];
+}
+
+// ----------------------------------------------------------------------------
+constexpr size_t CtrCipher::kDefaultRing;
+
+// ----------------------------------------------------------------------------
+CtrCipher::CtrCipher(CipherHandle cipher_, uint64_t nonce, size_t ring_size)
+  : cipher(cipher_), read(nonce), filled(nonce) {
+  size_t size = 256;
+  while (size < ring_size)
+    size <<= 1;
+  this->ring.resize(size);
+  this->mask = size - 1;
+  this->prefetch();
+}
+
+// ----------------------------------------------------------------------------
+void CtrCipher::prefetch() {
+  uint64_t target = this->read + this->ring.size();
+  while (this->filled != target) {
+    // stop at the end of the ring and wrap around on the next pass
+    size_t slot = this->filled & this->mask;
+    size_t length = this->ring.size() - slot;
+    if (length > target - this->filled)
+      length = static_cast<size_t>(target - this->filled);
+
+    generateKeystream(this->cipher, this->filled, &this->ring[slot], length);
+    this->filled += length;
+  }
+}
+
+// ----------------------------------------------------------------------------
+void CtrCipher::encrypt(const uint8_t* in, uint8_t* out, size_t n) {
+  while (n > 0) {
+    if (this->filled == this->read)
+      this->prefetch();
+
+    size_t slot = this->read & this->mask;
+    size_t length = this->ring.size() - slot;
+    if (length > this->filled - this->read)
+      length = static_cast<size_t>(this->filled - this->read);
+    if (length > n)
+      length = n;
+
+    applyKeystream(&this->ring[slot], in, out, length);
+    this->read += length;
+    in += length;
+    out += length;
+    n -= length;
+  }
+}
+
+// ----------------------------------------------------------------------------
+void CtrCipher::encrypt(std::string& data) {
+  if (data.empty())
+    return;
+
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(&data[0]);
+  this->encrypt(bytes, bytes, data.size());
+}
+
+// ----------------------------------------------------------------------------
+void CtrCipher::decryptAt(uint64_t counter, uint8_t* data, size_t n) const {
+  // keystream goes through a small stack buffer, one block at a time
+  uint8_t keystream[1024];
+  while (n > 0) {
+    size_t length = n < sizeof keystream ? n : sizeof keystream;
+    generateKeystream(this->cipher, counter, keystream, length);
+    applyKeystream(keystream, data, data, length);
+    counter += length;
+    data += length;
+    n -= length;
+  }
+}
+
+// ----------------------------------------------------------------------------
+void CtrCipher::decryptAt(uint64_t counter, std::string& data) const {
+  if (data.empty())
+    return;
+
+  this->decryptAt(counter, reinterpret_cast<uint8_t*>(&data[0]), data.size());
+}
+
+} // namespace DES
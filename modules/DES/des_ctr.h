@@ -0,0 +1,80 @@
+#ifndef DES_CTR_H
+#define DES_CTR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "des_cipher.h"
+#include "des_parallel.h"
+
+// Counter mode on top of the 8-bit block cipher. The counter is 64 bits
+// wide but the block is only 8, so a counter is compressed by chaining its
+// bytes through the cipher, most significant first:
+//
+//   x = 0;  for each byte b of the counter:  x = E(x ^ b)
+//
+// and the final x is the keystream byte. Counters that differ only in the
+// low byte share the first seven steps, so keystream is produced in runs of
+// up to 256 bytes with one table lookup per byte.
+
+namespace DES {
+
+// Keystream for counters [counter, counter + n)
+void generateKeystream(CipherHandle cipher, uint64_t counter, uint8_t* out, size_t n);
+
+// Same, split into chunks across a worker pool
+void generateKeystream(CipherHandle cipher, uint64_t counter, uint8_t* out, size_t n,
+                       WorkerPool& pool, size_t chunk = 256 << 10);
+
+// out[i] = in[i] ^ keystream[i]; `in` and `out` may be the same buffer
+void applyKeystream(const uint8_t* keystream, const uint8_t* in, uint8_t* out, size_t n);
+
+class CtrCipher {
+ public:
+  static constexpr size_t kDefaultRing = 64 << 10;
+
+  // `nonce` is the counter of the first byte sent. Every sender sharing a
+  // key needs its own nonce, so pick it at random per session. The ring
+  // size is rounded up to a power of two.
+  CtrCipher(CipherHandle cipher_, uint64_t nonce, size_t ring_size = kDefaultRing);
+  ~CtrCipher() = default;
+
+  // moving and copying is forbidden
+  CtrCipher(const CtrCipher&) = delete;
+  CtrCipher(CtrCipher&&) = delete;
+  CtrCipher& operator=(const CtrCipher&) = delete;
+  CtrCipher& operator=(CtrCipher&&) = delete;
+
+  // Counter of the next byte encrypt() will use. Send it along with the
+  // message so the receiver can decryptAt() it.
+  uint64_t counter() const { return this->read; }
+
+  // Encrypt with keystream from the ring and advance the counter. Falls back
+  // to generating inline if the ring has run dry.
+  void encrypt(const uint8_t* in, uint8_t* out, size_t n);
+  void encrypt(std::string& data);
+
+  // Top the ring back up to full. Call it off the send path (after a send,
+  // on a timer, or from another thread between encrypts).
+  void prefetch();
+  size_t buffered() const { return static_cast<size_t>(this->filled - this->read); }
+
+  // Random-access decryption of bytes that were encrypted from `counter`.
+  // Does not touch the ring and never allocates.
+  void decryptAt(uint64_t counter, uint8_t* data, size_t n) const;
+  void decryptAt(uint64_t counter, std::string& data) const;
+
+ private:
+  CipherHandle cipher;
+  std::vector<uint8_t> ring;
+  size_t mask;
+  uint64_t read;      // counter of the next byte to hand out
+  uint64_t filled;    // counter one past the last generated byte
+};
+
+} // namespace DES
+
+#endif // DES_CTR_H
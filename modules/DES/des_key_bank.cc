@@ -0,0 +1,30 @@
+#include "des_key_bank.h"
+
+namespace DES {
+
+// ----------------------------------------------------------------------------
+constexpr size_t KeyBank::kKeyCount;
+
+// ----------------------------------------------------------------------------
+KeyBank& KeyBank::instance() {
+  // ~512 KB of zeroed storage, so it lives in .bss rather than on the heap
+  static KeyBank bank;
+  return bank;
+}
+
+// ----------------------------------------------------------------------------
+const Tables& KeyBank::tables(uint16_t key) {
+  key &= kKeyCount - 1;
+  std::call_once(this->built[key], [this, key]() {
+    this->entries[key] = generateTables(key);
+  });
+  return this->entries[key];
+}
+
+// ----------------------------------------------------------------------------
+void KeyBank::warmAll() {
+  for (size_t key = 0; key < kKeyCount; ++key)
+    this->tables(static_cast<uint16_t>(key));
+}
+
+} // namespace DES
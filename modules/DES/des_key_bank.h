@@ -0,0 +1,43 @@
+#ifndef DES_KEY_BANK_H
+#define DES_KEY_BANK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+
+#include "des_cipher.h"
+
+namespace DES {
+
+// Process-wide, read-only tables for every key in the 10-bit key space
+// (1024 keys x 512 bytes). Each key's tables are built the first time that
+// key is asked for; warmAll() builds the rest up front.
+class KeyBank {
+ public:
+  static constexpr size_t kKeyCount = 1024;
+
+  static KeyBank& instance();
+
+  // Only the low 10 bits of a key take part in the schedule
+  const Tables& tables(uint16_t key);
+  CipherHandle cipher(uint16_t key) { return CipherHandle(this->tables(key)); }
+  void warmAll();
+
+  // moving and copying is forbidden
+  KeyBank(const KeyBank&) = delete;
+  KeyBank(KeyBank&&) = delete;
+  KeyBank& operator=(const KeyBank&) = delete;
+  KeyBank& operator=(KeyBank&&) = delete;
+
+ private:
+  KeyBank() = default;
+
+  // each 512-byte entry starts on its own cache line
+  alignas(64) Tables entries[kKeyCount];
+  std::once_flag built[kKeyCount];
+};
+
+} // namespace DES
+
+#endif // DES_KEY_BANK_H
@@ -0,0 +1,230 @@
+#include "des_key_search.h"
+
+#include <string.h>
+
+#include "des_bulk.h"
+#include "des_tables.h"
+
+namespace DES {
+namespace {
+
+constexpr size_t kKeyCount = 1024;
+
+typedef uint64_t Slice64;
+typedef uint64_t Slice256 __attribute__((vector_size(32)));
+
+// lane layout of a slice word
+template <typename W> struct Lanes;
+template <> struct Lanes<Slice64> {
+  static constexpr size_t kWords = 1;
+  static uint64_t get(const Slice64& w, size_t) { return w; }
+  static void set(Slice64& w, size_t, uint64_t v) { w = v; }
+};
+template <> struct Lanes<Slice256> {
+  static constexpr size_t kWords = 4;
+  static uint64_t get(const Slice256& w, size_t i) { return w[i]; }
+  // through memory: GCC takes a subscripted store for a read of the rest
+  // of the vector and warns that it is uninitialized
+  static void set(Slice256& w, size_t i, uint64_t v) {
+    memcpy(reinterpret_cast<uint64_t*>(&w) + i, &v, sizeof(v));
+  }
+};
+
+// bit i of both subkeys for every key, one 64-key group per entry
+struct SubkeySlices {
+  uint64_t key1[kKeyCount / 64][8];
+  uint64_t key2[kKeyCount / 64][8];
+};
+
+// ----------------------------------------------------------------------------
+SubkeySlices makeSubkeySlices() {
+  SubkeySlices slices{};
+  for (size_t key = 0; key < kKeyCount; ++key) {
+    Subkeys subkeys = generateSubkeys(static_cast<uint16_t>(key));
+    for (int bit = 0; bit < 8; ++bit) {
+      slices.key1[key / 64][bit] |= uint64_t((subkeys.key1 >> bit) & 1) << (key % 64);
+      slices.key2[key / 64][bit] |= uint64_t((subkeys.key2 >> bit) & 1) << (key % 64);
+    }
+  }
+  return slices;
+}
+
+// ----------------------------------------------------------------------------
+const SubkeySlices& subkeySlices() {
+  static const SubkeySlices slices = makeSubkeySlices();
+  return slices;
+}
+
+// ----------------------------------------------------------------------------
+// (the helpers take and fill references: 256-bit vectors passed by value
+// would change the calling convention between the AVX2 and generic builds)
+template <typename W>
+inline __attribute__((always_inline)) void broadcast(bool bit, W& out) {
+  W zero{};
+  out = bit ? ~zero : zero;
+}
+
+// ----------------------------------------------------------------------------
+// entry [r1 r0 c1 c0] of an S-box, bit `b`, for every lane at once. The
+// table is constexpr so the mux tree folds down to a boolean expression.
+template <typename W>
+inline __attribute__((always_inline))
+void sbox(const uint8_t (&box)[4][4], int b, const W& r1, const W& r0,
+          const W& c1, const W& c0, W& out) {
+  W level[16];
+  for (int i = 0; i < 16; ++i)
+    broadcast<W>((box[i >> 2][i & 3] >> b) & 1, level[i]);
+
+  // pick between pairs with the lowest index bit first
+  const W* select[4] = {&c0, &c1, &r0, &r1};
+  for (int s = 0, width = 16; s < 4; ++s, width /= 2)
+    for (int i = 0; i < width / 2; ++i)
+      level[i] = level[2 * i] ^ (*select[s] & (level[2 * i] ^ level[2 * i + 1]));
+  out = level[0];
+}
+
+// ----------------------------------------------------------------------------
+// bitsliced feistel(): d holds the 4 data bits, k the 8 subkey bits, and the
+// wiring mirrors the scalar version in des_tables.h bit for bit
+template <typename W>
+inline __attribute__((always_inline))
+void feistel(const W (&d)[4], const W (&k)[8], W (&out)[4]) {
+  // expansion and permutation, then incorporate the key
+  W p[8] = {d[3], d[0], d[1], d[2], d[1], d[2], d[3], d[0]};
+  for (int i = 0; i < 8; ++i)
+    p[i] ^= k[i];
+
+  // S-box 0: column from bits 5 and 6, row from bit 7 and (bit 6 | bit 4)
+  // S-box 1: column from bits 1 and 2, row from bit 3 and (bit 2 | bit 0)
+  // and the outputs land already permuted: 3 2 1 0 <- S0.0 S1.0 S1.1 S0.1
+  W row0 = p[6] | p[4];
+  W row1 = p[2] | p[0];
+  sbox(kS0, 0, p[7], row0, p[6], p[5], out[3]);
+  sbox(kS0, 1, p[7], row0, p[6], p[5], out[0]);
+  sbox(kS1, 0, p[3], row1, p[2], p[1], out[2]);
+  sbox(kS1, 1, p[3], row1, p[2], p[1], out[1]);
+}
+
+// ----------------------------------------------------------------------------
+// Lanes of the keys in [base, base + 64 * kWords) for which every sample
+// matches. The permutations do not depend on the key, so they are applied
+// to the samples in scalar code: the rounds must take initialPermutation(p)
+// to initialPermutation(c), since inversePermutation undoes it.
+template <typename W>
+inline __attribute__((always_inline))
+void matchGroup(const SubkeySlices& slices, size_t group, const uint8_t* plaintext,
+                const uint8_t* ciphertext, size_t n, W& match) {
+  W k1[8]{}, k2[8]{};
+  for (int bit = 0; bit < 8; ++bit) {
+    for (size_t w = 0; w < Lanes<W>::kWords; ++w) {
+      Lanes<W>::set(k1[bit], w, slices.key1[group + w][bit]);
+      Lanes<W>::set(k2[bit], w, slices.key2[group + w][bit]);
+    }
+  }
+
+  W zero{};
+  match = ~zero;
+  for (size_t i = 0; i < n; ++i) {
+    uint8_t in = initialPermutation(plaintext[i]);
+    uint8_t expected = initialPermutation(ciphertext[i]);
+
+    // the first round's input is the same for every key
+    W right[4], left[4], f[4];
+    for (int bit = 0; bit < 4; ++bit) {
+      broadcast<W>((in >> bit) & 1, right[bit]);
+      broadcast<W>((in >> (bit + 4)) & 1, left[bit]);
+    }
+
+    // first round: (L, R) -> (R, L ^ F(R, k1))
+    feistel(right, k1, f);
+    W mixed[4];
+    for (int bit = 0; bit < 4; ++bit)
+      mixed[bit] = left[bit] ^ f[bit];
+
+    // second round: L' = R ^ F(mixed, k2), R' = mixed
+    feistel(mixed, k2, f);
+    for (int bit = 0; bit < 4; ++bit) {
+      W low, high;
+      broadcast<W>((expected >> bit) & 1, low);
+      broadcast<W>((expected >> (bit + 4)) & 1, high);
+      match &= ~(mixed[bit] ^ low);
+      match &= ~(right[bit] ^ f[bit] ^ high);
+    }
+
+    // stop early once no key in the group survives
+    bool any = false;
+    for (size_t w = 0; w < Lanes<W>::kWords; ++w)
+      any = any || Lanes<W>::get(match, w) != 0;
+    if (!any)
+      break;
+  }
+}
+
+// ----------------------------------------------------------------------------
+template <typename W>
+inline __attribute__((always_inline))
+void searchAll(const uint8_t* plaintext, const uint8_t* ciphertext, size_t n,
+               std::vector<uint16_t>& keys) {
+  const SubkeySlices& slices = subkeySlices();
+  for (size_t group = 0; group < kKeyCount / 64; group += Lanes<W>::kWords) {
+    W match;
+    matchGroup<W>(slices, group, plaintext, ciphertext, n, match);
+    for (size_t w = 0; w < Lanes<W>::kWords; ++w) {
+      uint64_t lanes = Lanes<W>::get(match, w);
+      while (lanes) {
+        int lane = __builtin_ctzll(lanes);
+        keys.push_back(static_cast<uint16_t>((group + w) * 64 + lane));
+        lanes &= lanes - 1;
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+void search64(const uint8_t* plaintext, const uint8_t* ciphertext, size_t n,
+              std::vector<uint16_t>& keys) {
+  searchAll<Slice64>(plaintext, ciphertext, n, keys);
+}
+
+// ----------------------------------------------------------------------------
+void search256(const uint8_t* plaintext, const uint8_t* ciphertext, size_t n,
+               std::vector<uint16_t>& keys) {
+  searchAll<Slice256>(plaintext, ciphertext, n, keys);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// ----------------------------------------------------------------------------
+// same code, but each 256-bit slice operation is a single AVX2 instruction
+__attribute__((target("avx2")))
+void search256AVX2(const uint8_t* plaintext, const uint8_t* ciphertext, size_t n,
+                   std::vector<uint16_t>& keys) {
+  searchAll<Slice256>(plaintext, ciphertext, n, keys);
+}
+#endif
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+std::vector<uint16_t> searchKeys(const uint8_t* plaintext, const uint8_t* ciphertext,
+                                 size_t n, SliceWidth width) {
+  std::vector<uint16_t> keys;
+  bool avx2 = activeKernel() >= Kernel::kAVX2;
+  if (width == SliceWidth::kAuto)
+    width = avx2 ? SliceWidth::k256 : SliceWidth::k64;
+
+  if (width == SliceWidth::k64) {
+    search64(plaintext, ciphertext, n, keys);
+    return keys;
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  if (avx2) {
+    search256AVX2(plaintext, ciphertext, n, keys);
+    return keys;
+  }
+#endif
+  search256(plaintext, ciphertext, n, keys);
+  return keys;
+}
+
+} // namespace DES
@@ -0,0 +1,28 @@
+#ifndef DES_KEY_SEARCH_H
+#define DES_KEY_SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace DES {
+
+// Number of keys evaluated together. Each bit of the cipher state is held in
+// a word whose lane j belongs to key (base + j), so the Feistel rounds run
+// for a whole batch of keys with plain bitwise operations.
+enum class SliceWidth {
+  kAuto,  // widest the CPU runs natively
+  k64,    // one uint64_t per state bit
+  k256    // one 256-bit vector per state bit
+};
+
+// Every key in the 10-bit key space under which each plaintext[i] encrypts
+// to ciphertext[i], in ascending order. Keys whose schedules coincide are
+// all reported. With no samples every key matches.
+std::vector<uint16_t> searchKeys(const uint8_t* plaintext, const uint8_t* ciphertext,
+                                 size_t n, SliceWidth width = SliceWidth::kAuto);
+
+} // namespace DES
+
+#endif // DES_KEY_SEARCH_H
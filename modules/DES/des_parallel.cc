@@ -0,0 +1,149 @@
+#include "des_parallel.h"
+
+namespace DES {
+namespace {
+
+// one parallelFor job for ParallelCipher::run
+struct ChunkJob {
+  CipherHandle cipher;
+  bool encrypting;
+  const uint8_t* in;
+  uint8_t* out;
+  size_t n;
+  size_t chunk;
+};
+
+// ----------------------------------------------------------------------------
+void runChunk(void* context, size_t index) {
+  const ChunkJob& job = *static_cast<const ChunkJob*>(context);
+  size_t offset = index * job.chunk;
+  size_t length = job.n - offset < job.chunk ? job.n - offset : job.chunk;
+  if (job.encrypting)
+    job.cipher.encrypt(job.in + offset, job.out + offset, length);
+  else
+    job.cipher.decrypt(job.in + offset, job.out + offset, length);
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+WorkerPool::WorkerPool(size_t threads) {
+  this->workers.reserve(threads);
+  for (size_t i = 0; i < threads; ++i)
+    this->workers.emplace_back(&WorkerPool::work, this);
+}
+
+// ----------------------------------------------------------------------------
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(this->state_mutex);
+    this->stopping = true;
+  }
+  this->wake.notify_all();
+  for (std::thread& worker : this->workers)
+    worker.join();
+}
+
+// ----------------------------------------------------------------------------
+WorkerPool& WorkerPool::shared() {
+  static WorkerPool pool(std::thread::hardware_concurrency() > 1
+                         ? std::thread::hardware_concurrency() - 1 : 0);
+  return pool;
+}
+
+// ----------------------------------------------------------------------------
+void WorkerPool::parallelFor(size_t count, void (*task)(void*, size_t), void* context) {
+  std::lock_guard<std::mutex> job_lock(this->job_mutex);
+  {
+    std::lock_guard<std::mutex> lock(this->state_mutex);
+    this->task = task;
+    this->context = context;
+    this->count = count;
+    this->next.store(0, std::memory_order_relaxed);
+    this->busy = this->workers.size();
+    ++this->generation;
+  }
+  this->wake.notify_all();
+
+  // help out, then wait for the stragglers
+  this->drain();
+  std::unique_lock<std::mutex> lock(this->state_mutex);
+  this->done.wait(lock, [this]() { return this->busy == 0; });
+}
+
+// ----------------------------------------------------------------------------
+void WorkerPool::work() {
+  uint64_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(this->state_mutex);
+      this->wake.wait(lock, [this, seen]() {
+        return this->stopping || this->generation != seen;
+      });
+      if (this->stopping)
+        return;
+      seen = this->generation;
+    }
+
+    this->drain();
+
+    std::lock_guard<std::mutex> lock(this->state_mutex);
+    if (--this->busy == 0)
+      this->done.notify_one();
+  }
+}
+
+// ----------------------------------------------------------------------------
+void WorkerPool::drain() {
+  // task, context and count were published under state_mutex before the
+  // generation changed, so they are stable for the whole job
+  size_t i;
+  while ((i = this->next.fetch_add(1, std::memory_order_relaxed)) < this->count)
+    this->task(this->context, i);
+}
+
+// ----------------------------------------------------------------------------
+void ParallelCipher::encrypt(const uint8_t* in, uint8_t* out, size_t n) const {
+  this->run(true, in, out, n);
+}
+
+// ----------------------------------------------------------------------------
+void ParallelCipher::encrypt(const std::string& plaintext, std::string& result) const {
+  result.resize(plaintext.size());
+  if (plaintext.empty())
+    return;
+
+  this->run(true, reinterpret_cast<const uint8_t*>(plaintext.data()),
+            reinterpret_cast<uint8_t*>(&result[0]), plaintext.size());
+}
+
+// ----------------------------------------------------------------------------
+void ParallelCipher::decrypt(const uint8_t* in, uint8_t* out, size_t n) const {
+  this->run(false, in, out, n);
+}
+
+// ----------------------------------------------------------------------------
+void ParallelCipher::decrypt(const std::string& ciphertext, std::string& result) const {
+  result.resize(ciphertext.size());
+  if (ciphertext.empty())
+    return;
+
+  this->run(false, reinterpret_cast<const uint8_t*>(ciphertext.data()),
+            reinterpret_cast<uint8_t*>(&result[0]), ciphertext.size());
+}
+
+// ----------------------------------------------------------------------------
+void ParallelCipher::run(bool encrypting, const uint8_t* in, uint8_t* out,
+                         size_t n) const {
+  size_t chunk = this->options.chunk ? this->options.chunk : n;
+  ChunkJob job{this->cipher, encrypting, in, out, n, chunk};
+  if (n < this->options.threshold || this->pool.size() == 0 || n <= chunk) {
+    for (size_t i = 0; i * chunk < n; ++i)
+      runChunk(&job, i);
+    return;
+  }
+
+  this->pool.parallelFor((n + chunk - 1) / chunk, &runChunk, &job);
+}
+
+} // namespace DES
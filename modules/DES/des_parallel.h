@@ -0,0 +1,93 @@
+#ifndef DES_PARALLEL_H
+#define DES_PARALLEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "des_cipher.h"
+
+namespace DES {
+
+// Fixed set of worker threads that split index ranges between them. The
+// calling thread works too, so a pool of N threads uses N + 1 cores.
+class WorkerPool {
+ public:
+  explicit WorkerPool(size_t threads);
+  ~WorkerPool();
+
+  // moving and copying is forbidden
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool(WorkerPool&&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+  WorkerPool& operator=(WorkerPool&&) = delete;
+
+  // One worker less than the hardware has, created on first use
+  static WorkerPool& shared();
+
+  size_t size() const { return this->workers.size(); }
+
+  // Run task(context, i) for every i in [0, count) and return once all are
+  // done. Calls from different threads take turns.
+  void parallelFor(size_t count, void (*task)(void*, size_t), void* context);
+
+ private:
+  void work();
+  void drain();
+
+  std::vector<std::thread> workers;
+  std::mutex job_mutex;     // one parallelFor at a time
+  std::mutex state_mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+
+  // the job currently running, guarded by state_mutex
+  void (*task)(void*, size_t) = nullptr;
+  void* context = nullptr;
+  size_t count = 0;
+  uint64_t generation = 0;
+  size_t busy = 0;
+  bool stopping = false;
+
+  std::atomic<size_t> next{0};
+};
+
+struct ParallelOptions {
+  // buffers below this stay on the calling thread
+  size_t threshold = 1 << 20;
+
+  // bytes per task, small enough to stay in a core's L2
+  size_t chunk = 256 << 10;
+};
+
+// Bulk encryption that splits large buffers into chunks across a WorkerPool.
+// The cipher is a single byte substitution with no chaining, so chunks are
+// independent. Like CipherHandle, this does not own the tables.
+class ParallelCipher {
+ public:
+  ParallelCipher(CipherHandle cipher_, WorkerPool& pool_ = WorkerPool::shared(),
+                 const ParallelOptions& options_ = ParallelOptions())
+    : cipher(cipher_), pool(pool_), options(options_) {}
+
+  void encrypt(const uint8_t* in, uint8_t* out, size_t n) const;
+  void encrypt(const std::string& plaintext, std::string& result) const;
+  void decrypt(const uint8_t* in, uint8_t* out, size_t n) const;
+  void decrypt(const std::string& ciphertext, std::string& result) const;
+
+ private:
+  void run(bool encrypting, const uint8_t* in, uint8_t* out, size_t n) const;
+
+  CipherHandle cipher;
+  WorkerPool& pool;
+  ParallelOptions options;
+};
+
+} // namespace DES
+
+#endif // DES_PARALLEL_H
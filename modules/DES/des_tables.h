@@ -0,0 +1,180 @@
+#ifndef DES_TABLES_H
+#define DES_TABLES_H
+
+#include <stdint.h>
+
+// Compile-time form of the cipher: the S-boxes, the key schedule and the
+// per-key byte tables are all constexpr so that fixed keys can be baked into
+// the binary (see FixedCipher in des_cipher.h).
+
+namespace DES {
+
+constexpr uint16_t kDefaultKey = 0x2D7; // 0b1011010111
+
+constexpr uint8_t kS0[4][4] = {{1,0,3,2},
+                               {3,2,1,0},
+                               {0,2,1,3},
+                               {3,1,3,2}};
+
+constexpr uint8_t kS1[4][4] = {{0,1,2,3},
+                               {2,0,1,3},
+                               {3,0,1,0},
+                               {2,1,0,3}};
+
+struct Subkeys {
+  uint8_t key1;
+  uint8_t key2;
+};
+
+// every block's image under a key, in both directions
+struct Tables {
+  uint8_t encrypt[256];
+  uint8_t decrypt[256];
+};
+
+// ----------------------------------------------------------------------------
+// circular left shift of a 5-bit half key
+constexpr uint16_t rotateHalf(uint16_t half) {
+  return ((half << 1) | ((half & 0x10) >> 4)) & 0x1F;
+}
+
+// ----------------------------------------------------------------------------
+// permute 10 bits and strip off the two most significant to get a subkey
+constexpr uint8_t compressSubkey(uint16_t halves) {
+  return ((halves & 0x00000300)
+        | ((halves & 0x00000005) << 1)
+        | ((halves & 0x00000008) << 2)
+        | ((halves & 0x00000010) << 3)
+        | ((halves & 0x00000020) >> 3)
+        | ((halves & 0x00000040) >> 2)
+        | ((halves & 0x00000082) >> 1)) & 0x0FF;
+}
+
+// ----------------------------------------------------------------------------
+constexpr Subkeys generateSubkeys(uint16_t key) {
+  // initial permutation: 1 2 3 4 5 6 7 8 9 10  -->  3 5 2 7 4 10 1 9 8 6
+  // Original: 1011010111 (2D7)
+  // Permuted: 1000111111 (23F)
+
+  // Credit: http://programming.sirrida.de/calcperm.php for this permutation
+  uint16_t permuted = ((key & 0x00000002) << 1)
+                    | ((key & 0x00000080) << 2)
+                    | ((key & 0x00000028) << 3)
+                    | ((key & 0x00000001) << 4)
+                    | ((key & 0x00000200) >> 6)
+                    | ((key & 0x00000010) >> 4)
+                    | ((key & 0x00000144) >> 1);
+
+  // mask the permuted key to get the left and right halves, and shift each
+  uint16_t left = rotateHalf((permuted & (0x1F << 5)) >> 5);
+  uint16_t right = rotateHalf(permuted & 0x1F);
+  uint8_t key1 = compressSubkey((left << 5) | right);
+
+  // shift the halves again for key 2
+  left = rotateHalf(left);
+  right = rotateHalf(right);
+  uint8_t key2 = compressSubkey((left << 5) | right);
+
+  return Subkeys{key1, key2};
+}
+
+// ----------------------------------------------------------------------------
+constexpr uint8_t feistel(uint8_t data, uint8_t key) {
+  // expansion and permutation
+  uint8_t carry = data & 0x01;
+  uint8_t left = (data >> 1) | (carry << 3);
+
+  carry = (data & 0x08) >> 3;
+  uint8_t right = ((data << 1) | carry) & 0x0F;
+
+  // concatenate left and right, and incorporate the key
+  uint8_t permuted = ((left << 4) | right) ^ key;
+
+  // calculate bits coming from S-box 0 (left)
+  // column is from bits 5 and 6 (0 indexed), row is from bits 4 and 7
+  uint8_t col = (permuted >> 5) & 0x03;
+  carry = (permuted & 0x10) >> 4;
+  uint8_t row = ((permuted >> 6) | carry) & 0x03;
+  uint8_t two_bit_left = kS0[row][col] & 0x03;
+
+  // calculate bits coming from S-box 1 (right)
+  // column is from bits 1 and 2, row is from bits 0 and 3
+  col = (permuted >> 1) & 0x03;
+  carry = permuted & 0x01;
+  row = ((permuted >> 2) | carry) & 0x03;
+  uint8_t two_bit_right = kS1[row][col] & 0x03;
+
+  // concatenate and permute the bits again
+  return ((two_bit_left & 0x01) << 3) | ((two_bit_right & 0x01) << 2)
+          | (two_bit_right & 0x02) | ((two_bit_left & 0x02) >> 1);
+}
+
+// ----------------------------------------------------------------------------
+// permute bit positions: 1 2 3 4 5 6 7 8  -->  2 6 3 1 4 8 5 7
+constexpr uint8_t initialPermutation(uint8_t block) {
+  return (block & 0x00000020)
+       | ((block & 0x00000040) << 1)
+       | ((block & 0x00000001) << 2)
+       | ((block & 0x00000004) << 4)
+       | ((block & 0x00000080) >> 3)
+       | ((block & 0x00000008) >> 2)
+       | ((block & 0x00000012) >> 1);
+}
+
+// ----------------------------------------------------------------------------
+constexpr uint8_t inversePermutation(uint8_t block) {
+  return (block & 0x00000020)
+       | ((block & 0x00000009) << 1)
+       | ((block & 0x00000002) << 2)
+       | ((block & 0x00000010) << 3)
+       | ((block & 0x00000040) >> 4)
+       | ((block & 0x00000004) >> 2)
+       | ((block & 0x00000080) >> 1);
+}
+
+// ----------------------------------------------------------------------------
+// two Feistel rounds, the first with `first` and the second with `second`
+constexpr uint8_t rounds(uint8_t block, uint8_t first, uint8_t second) {
+  block = initialPermutation(block);
+
+  // separate into left and right
+  uint8_t left = (block & (0xF << 4)) >> 4;
+  uint8_t right = block & 0xF;
+
+  // first round
+  uint8_t temp = right;
+  right = left ^ feistel(right, first);
+  left = temp;
+
+  // second round
+  left = left ^ feistel(right, second);
+
+  // concatenate left and right and reverse the permutation
+  return inversePermutation((left << 4) | right);
+}
+
+// ----------------------------------------------------------------------------
+constexpr uint8_t encryptBlock(uint8_t plain, Subkeys subkeys) {
+  return rounds(plain, subkeys.key1, subkeys.key2);
+}
+
+// ----------------------------------------------------------------------------
+constexpr uint8_t decryptBlock(uint8_t cipher, Subkeys subkeys) {
+  return rounds(cipher, subkeys.key2, subkeys.key1);
+}
+
+// ----------------------------------------------------------------------------
+constexpr Tables generateTables(uint16_t key) {
+  Subkeys subkeys = generateSubkeys(key);
+  Tables tables{};
+  for (int i = 0; i < 256; ++i) {
+    uint8_t block = static_cast<uint8_t>(i);
+    tables.encrypt[block] = encryptBlock(block, subkeys);
+    tables.decrypt[block] = decryptBlock(block, subkeys);
+  }
+  return tables;
+}
+
+} // namespace DES
+
+#endif // DES_TABLES_H
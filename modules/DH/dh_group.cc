@@ -0,0 +1,320 @@
+#include "dh_group.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include "dh_modexp.h"
+
+namespace DH {
+
+namespace {
+  // ----------------------------------------------------------------------------
+  // window width for an exponent of the given length, as OpenSSL picks it:
+  // the table of odd powers costs 2^(w-1) multiplications and saves about
+  // bits / (w + 1) of them
+  size_t window_for(size_t bits) {
+    return bits > 671 ? 6 : bits > 239 ? 5 : bits > 79 ? 4 : bits > 23 ? 3 : 1;
+  }
+
+  // ----------------------------------------------------------------------------
+  // P, once it is known to do for a Group
+  const Number& checked(const Number& P, const Number& G) {
+    const char* problem = Group::check(P, G);
+    if (problem != NULL) {
+      std::cerr << "ERROR: " << problem << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    return P;
+  }
+}
+
+// ----------------------------------------------------------------------------
+const char* Group::check(const Number& P, const Number& G) {
+  if (P.bits() < 3 || (P.low() & 1) == 0 || P == Number(3) || P.limbs().size() > kMaxLimbs)
+    return "P must be an odd prime of 5 to 8192 bits";
+  std::vector<uint64_t> limbs = P.limbs();
+  limbs[0] -= 1;
+  if (G.compare(Number(1)) <= 0 || G.compare(Number(limbs)) >= 0)
+    return "G must be between 1 and P - 1";
+  return NULL;
+}
+
+// ----------------------------------------------------------------------------
+Group::Group(const Number& P, const Number& G)
+    : P_(checked(P, G)), G_(G), n_(P.limbs().size()), word_(P.low()) {
+  std::vector<uint64_t> limbs = P.limbs();
+  limbs[0] -= 1;
+  this->P_minus_one_ = Number(limbs);
+  this->exponent_bits_ = std::min(kExponentBits, P.bits() - 1);
+  this->modulus_ = P.limbs();
+  this->inverse_ = 0 - inverse64(this->modulus_[0]);
+
+  // R and R^2 mod P, by doubling 1 that many times
+  this->one_.assign(this->n_, 0);
+  this->one_[0] = 1;
+  for (size_t i = 0; i < 64 * this->n_; ++i)
+    this->doubleMod(this->one_.data());
+  this->r2_ = this->one_;
+  for (size_t i = 0; i < 64 * this->n_; ++i)
+    this->doubleMod(this->r2_.data());
+}
+
+// ----------------------------------------------------------------------------
+void Group::doubleMod(uint64_t* x) const {
+  uint64_t carry = 0;
+  for (size_t i = 0; i < this->n_; ++i) {
+    uint64_t next = x[i] >> 63;
+    x[i] = (x[i] << 1) | carry;
+    carry = next;
+  }
+  // subtract P if the doubled value reached it
+  uint64_t difference[kMaxLimbs];
+  uint64_t borrow = 0;
+  for (size_t i = 0; i < this->n_; ++i) {
+    uint128_t d = static_cast<uint128_t>(x[i]) - this->modulus_[i] - borrow;
+    difference[i] = static_cast<uint64_t>(d);
+    borrow = static_cast<uint64_t>(d >> 64) & 1;
+  }
+  if (carry != 0 || borrow == 0)
+    memcpy(x, difference, this->n_ * sizeof(uint64_t));
+}
+
+// ----------------------------------------------------------------------------
+void Group::multiply(const uint64_t* a, const uint64_t* b, uint64_t* out) const {
+  // coarsely integrated operand scanning: add a b[i], then add the multiple
+  // of P that clears the lowest limb and shift it out, one limb of b at a
+  // time. t stays below 2P throughout
+  const size_t n = this->n_;
+  const uint64_t* p = this->modulus_.data();
+  uint64_t t[kMaxLimbs + 2];
+  memset(t, 0, (n + 2) * sizeof(uint64_t));
+
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t carry = 0;
+    uint64_t multiplier = b[i];
+    for (size_t j = 0; j < n; ++j) {
+      uint128_t sum = static_cast<uint128_t>(a[j]) * multiplier + t[j] + carry;
+      t[j] = static_cast<uint64_t>(sum);
+      carry = static_cast<uint64_t>(sum >> 64);
+    }
+    uint128_t sum = static_cast<uint128_t>(t[n]) + carry;
+    t[n] = static_cast<uint64_t>(sum);
+    t[n + 1] = static_cast<uint64_t>(sum >> 64);
+
+    uint64_t m = t[0] * this->inverse_;
+    sum = static_cast<uint128_t>(m) * p[0] + t[0];
+    carry = static_cast<uint64_t>(sum >> 64);
+    for (size_t j = 1; j < n; ++j) {
+      sum = static_cast<uint128_t>(m) * p[j] + t[j] + carry;
+      t[j - 1] = static_cast<uint64_t>(sum);
+      carry = static_cast<uint64_t>(sum >> 64);
+    }
+    sum = static_cast<uint128_t>(t[n]) + carry;
+    t[n - 1] = static_cast<uint64_t>(sum);
+    t[n] = t[n + 1] + static_cast<uint64_t>(sum >> 64);
+  }
+
+  this->reduceOnce(t, out);
+}
+
+// ----------------------------------------------------------------------------
+void Group::reduceOnce(const uint64_t* t, uint64_t* out) const {
+  // t has n + 1 limbs and is below 2P: one subtraction of P brings it below P
+  const size_t n = this->n_;
+  uint64_t difference[kMaxLimbs];
+  uint64_t borrow = 0;
+  for (size_t j = 0; j < n; ++j) {
+    uint128_t d = static_cast<uint128_t>(t[j]) - this->modulus_[j] - borrow;
+    difference[j] = static_cast<uint64_t>(d);
+    borrow = static_cast<uint64_t>(d >> 64) & 1;
+  }
+  memcpy(out, (t[n] != 0 || borrow == 0) ? difference : t, n * sizeof(uint64_t));
+}
+
+// ----------------------------------------------------------------------------
+void Group::square(uint64_t* a) const {
+  // the full square first, each cross product a[i] a[j] computed once and
+  // doubled, which saves a quarter of the word multiplications; then the
+  // Montgomery reduction of all 2n limbs
+  const size_t n = this->n_;
+  const uint64_t* p = this->modulus_.data();
+  uint64_t t[2 * kMaxLimbs + 1];
+  memset(t, 0, (2 * n + 1) * sizeof(uint64_t));
+
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t carry = 0;
+    for (size_t j = i + 1; j < n; ++j) {
+      uint128_t sum = static_cast<uint128_t>(a[i]) * a[j] + t[i + j] + carry;
+      t[i + j] = static_cast<uint64_t>(sum);
+      carry = static_cast<uint64_t>(sum >> 64);
+    }
+    t[i + n] = carry;
+  }
+  uint64_t shifted = 0;
+  for (size_t k = 0; k < 2 * n; ++k) {
+    uint64_t next = t[k] >> 63;
+    t[k] = (t[k] << 1) | shifted;
+    shifted = next;
+  }
+  uint64_t carry = 0;
+  for (size_t i = 0; i < n; ++i) {
+    uint128_t sum = static_cast<uint128_t>(a[i]) * a[i] + t[2 * i] + carry;
+    t[2 * i] = static_cast<uint64_t>(sum);
+    sum = static_cast<uint128_t>(t[2 * i + 1]) + static_cast<uint64_t>(sum >> 64);
+    t[2 * i + 1] = static_cast<uint64_t>(sum);
+    carry = static_cast<uint64_t>(sum >> 64);
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t m = t[i] * this->inverse_;
+    carry = 0;
+    for (size_t j = 0; j < n; ++j) {
+      uint128_t sum = static_cast<uint128_t>(m) * p[j] + t[i + j] + carry;
+      t[i + j] = static_cast<uint64_t>(sum);
+      carry = static_cast<uint64_t>(sum >> 64);
+    }
+    for (size_t k = i + n; carry != 0; ++k) {
+      uint128_t sum = static_cast<uint128_t>(t[k]) + carry;
+      t[k] = static_cast<uint64_t>(sum);
+      carry = static_cast<uint64_t>(sum >> 64);
+    }
+  }
+  this->reduceOnce(t + n, a);
+}
+
+// ----------------------------------------------------------------------------
+void Group::enter(const Number& x, uint64_t* out) const {
+  uint64_t plain[kMaxLimbs] = {0};
+  std::copy(x.limbs().begin(), x.limbs().end(), plain);
+  this->multiply(plain, this->r2_.data(), out);
+}
+
+// ----------------------------------------------------------------------------
+Number Group::leave(const uint64_t* x) const {
+  uint64_t unit[kMaxLimbs] = {1};
+  std::vector<uint64_t> limbs(this->n_);
+  this->multiply(x, unit, limbs.data());
+  return Number(std::move(limbs));
+}
+
+// ----------------------------------------------------------------------------
+bool Group::acceptable(const Number& y) const {
+  return y.compare(Number(1)) > 0 && y.compare(this->P_minus_one_) < 0;
+}
+
+// ----------------------------------------------------------------------------
+void Group::generate(Number& x, Number& public_value) const {
+  std::random_device random;
+  std::vector<uint64_t> limbs((this->exponent_bits_ + 63) / 64);
+  size_t top = (this->exponent_bits_ - 1) % 64;
+  do {
+    for (uint64_t& limb : limbs)
+      limb = (static_cast<uint64_t>(random()) << 32) | random();
+    // exactly exponent_bits_ long
+    if (top != 63)
+      limbs.back() &= (static_cast<uint64_t>(1) << (top + 1)) - 1;
+    limbs.back() |= static_cast<uint64_t>(1) << top;
+    x = Number(limbs);
+    public_value = this->publicValue(x);
+  } while (!this->acceptable(public_value));
+}
+
+// ----------------------------------------------------------------------------
+Number Group::pow(const Number& base, const Number& exponent) const {
+  size_t bits = exponent.bits();
+  if (bits == 0)
+    return Number(1);
+  // a one-limb P needs no limb loops, nor a window for so short an exponent
+  if (this->n_ == 1 && bits <= 64)
+    return Number(this->word_.pow(base.low(), exponent.low()));
+
+  // odd powers base, base^3, ..., base^(2^w - 1)
+  size_t n = this->n_;
+  size_t window = window_for(bits);
+  std::vector<uint64_t> odd((static_cast<size_t>(1) << (window - 1)) * n);
+  this->enter(base, odd.data());
+  if (window > 1) {
+    uint64_t squared[kMaxLimbs];
+    this->multiply(odd.data(), odd.data(), squared);
+    for (size_t k = 1; k < (static_cast<size_t>(1) << (window - 1)); ++k)
+      this->multiply(odd.data() + (k - 1) * n, squared, odd.data() + k * n);
+  }
+
+  // from the top: zeros square, and the longest run of at most w bits that
+  // ends in a one squares that often and multiplies by its odd power
+  uint64_t result[kMaxLimbs];
+  bool started = false;
+  long i = static_cast<long>(bits) - 1;
+  while (i >= 0) {
+    if (!exponent.bit(i)) {
+      this->square(result);
+      --i;
+      continue;
+    }
+    long j = std::max(i - static_cast<long>(window) + 1, 0L);
+    while (!exponent.bit(j))
+      ++j;
+    size_t value = 0;
+    for (long k = i; k >= j; --k)
+      value = (value << 1) | exponent.bit(k);
+
+    const uint64_t* power = odd.data() + (value >> 1) * n;
+    if (started) {
+      for (long k = i; k >= j; --k)
+        this->square(result);
+      this->multiply(result, power, result);
+    } else {
+      memcpy(result, power, n * sizeof(uint64_t));
+      started = true;
+    }
+    i = j - 1;
+  }
+  return this->leave(result);
+}
+
+// ----------------------------------------------------------------------------
+void Group::precompute() {
+  // kCombTeeth rows of spacing_ bits each cover an exponent; entry 2^j is
+  // G^(2^(j spacing)), and every other entry the product of those of its bits
+  size_t n = this->n_;
+  this->spacing_ = (this->exponent_bits_ + kCombTeeth - 1) / kCombTeeth;
+  this->comb_.assign((static_cast<size_t>(1) << kCombTeeth) * n, 0);
+  std::copy(this->one_.begin(), this->one_.end(), this->entry(0));
+  this->enter(this->G_, this->entry(1));
+  for (size_t j = 1; j < kCombTeeth; ++j) {
+    uint64_t* row = this->entry(static_cast<size_t>(1) << j);
+    memcpy(row, this->entry(static_cast<size_t>(1) << (j - 1)), n * sizeof(uint64_t));
+    for (size_t k = 0; k < this->spacing_; ++k)
+      this->square(row);
+  }
+  for (size_t i = 3; i < (static_cast<size_t>(1) << kCombTeeth); ++i) {
+    size_t lowest = i & (0 - i);
+    if (lowest != i)
+      this->multiply(this->entry(i - lowest), this->entry(lowest), this->entry(i));
+  }
+}
+
+// ----------------------------------------------------------------------------
+Number Group::publicValue(const Number& x) const {
+  if (this->comb_.empty() || x.bits() > kCombTeeth * this->spacing_)
+    return this->pow(this->G_, x);
+
+  // one column of the comb per step: the bit of x at that column in each row
+  uint64_t result[kMaxLimbs];
+  memcpy(result, this->one_.data(), this->n_ * sizeof(uint64_t));
+  for (size_t column = this->spacing_; column-- > 0;) {
+    this->square(result);
+    size_t index = 0;
+    for (size_t j = 0; j < kCombTeeth; ++j)
+      index |= static_cast<size_t>(x.bit(j * this->spacing_ + column)) << j;
+    if (index != 0)
+      this->multiply(result, this->entry(index), result);
+  }
+  return this->leave(result);
+}
+
+} // namespace DH
@@ -0,0 +1,98 @@
+#ifndef DH_GROUP_H
+#define DH_GROUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "dh_modexp.h"
+#include "dh_number.h"
+
+namespace DH {
+
+// the largest modulus a Group takes, in limbs: 8192 bits
+const size_t kMaxLimbs = 128;
+// Private exponents are this long, or a bit shorter than P where P is
+// shorter still. Twice the 128 bits of security a 3072-bit group has
+const size_t kExponentBits = 256;
+// rows of the fixed-base comb, which has 2^kCombTeeth - 1 entries
+const size_t kCombTeeth = 8;
+
+// Diffie-Hellman in the group of a prime P with generator G, for P of any
+// size up to kMaxLimbs limbs.
+//
+// Values are kept in Montgomery form on 64-bit limbs, with R = 2^(64 n) for
+// an n-limb P, so a modular multiplication is n^2 word multiplications
+// twice over and never a division. pow() raises any value with a
+// left-to-right sliding window. G itself is raised once per handshake on a
+// server; precompute() gives it a fixed-base comb, which for kExponentBits
+// exponents takes 32 squarings and 32 multiplications instead of 256 and
+// about 45.
+class Group {
+ public:
+  // P must be an odd prime bigger than 3, and 1 < G < P - 1
+  Group(const Number& P, const Number& G);
+
+  // what is wrong with P and G for a Group, NULL if nothing obvious. P is
+  // not tested for primality
+  static const char* check(const Number& P, const Number& G);
+
+  const Number& P() const { return this->P_; }
+  const Number& G() const { return this->G_; }
+  // bytes of a value on the wire
+  size_t width() const { return (this->P_.bits() + 7) / 8; }
+  size_t exponentBits() const { return this->exponent_bits_; }
+
+  // a fresh private exponent x and G^x. x is drawn again in the (small
+  // group only) case that G^x would not be acceptable to the peer
+  void generate(Number& x, Number& public_value) const;
+  // G^x, from the comb once there is one
+  Number publicValue(const Number& x) const;
+  // base^exponent mod P for base < P, say the secret from the peer's value
+  Number pow(const Number& base, const Number& exponent) const;
+  // whether the peer's public value may be used: 1 < y < P - 1
+  bool acceptable(const Number& y) const;
+
+  // Build the comb for G: a few hundred multiplications and 2^kCombTeeth
+  // values of P's size, paid back after a handful of publicValue() calls
+  void precompute();
+  bool precomputed() const { return !this->comb_.empty(); }
+
+ private:
+  // out = a b R^-1 mod P, all n limbs; out may be a or b
+  void multiply(const uint64_t* a, const uint64_t* b, uint64_t* out) const;
+  // a = a a R^-1 mod P, in place
+  void square(uint64_t* a) const;
+  // out = t mod P for t < 2P of n + 1 limbs
+  void reduceOnce(const uint64_t* t, uint64_t* out) const;
+  // 2x mod P, for R and R^2 while setting up
+  void doubleMod(uint64_t* x) const;
+  void enter(const Number& x, uint64_t* out) const;
+  Number leave(const uint64_t* x) const;
+  uint64_t* entry(size_t index) { return this->comb_.data() + index * this->n_; }
+  const uint64_t* entry(size_t index) const { return this->comb_.data() + index * this->n_; }
+
+  Number P_;
+  Number G_;
+  Number P_minus_one_;
+  size_t n_;
+  // the same arithmetic on one word, for a P of one limb
+  Montgomery word_;
+  size_t exponent_bits_;
+
+  std::vector<uint64_t> modulus_;
+  // -P^-1 mod 2^64, R mod P (one, in Montgomery form) and R^2 mod P
+  uint64_t inverse_;
+  std::vector<uint64_t> one_;
+  std::vector<uint64_t> r2_;
+
+  // Entry i of the comb is the product of G^(2^(j spacing)) over the set
+  // bits j of i, in Montgomery form
+  size_t spacing_;
+  std::vector<uint64_t> comb_;
+};
+
+} // namespace DH
+
+#endif // DH_GROUP_H
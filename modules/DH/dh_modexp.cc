@@ -0,0 +1,131 @@
+#include "dh_modexp.h"
+
+namespace DH {
+
+namespace {
+  // exponentiations interleaved by the batch paths: enough independent
+  // multiplications to keep the multiplier busy while each one's result is
+  // still on its way
+  const size_t kLanes = 4;
+
+  // ----------------------------------------------------------------------------
+  int top_bit(uint64_t x) {
+    return 63 - __builtin_clzll(x);
+  }
+}
+
+// ----------------------------------------------------------------------------
+uint64_t modexp(uint64_t base, uint64_t exponent, uint64_t modulus) {
+  if (modulus & 1)
+    return Montgomery(modulus).pow(base, exponent);
+
+  uint64_t result = 1 % modulus;
+  base %= modulus;
+  for (; exponent != 0; exponent >>= 1) {
+    if (exponent & 1)
+      result = mulmod(result, base, modulus);
+    base = mulmod(base, base, modulus);
+  }
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+void modexp(const uint64_t* bases, const uint64_t* exponents, uint64_t* results,
+            size_t count, uint64_t modulus) {
+  if (modulus & 1) {
+    Montgomery(modulus).pow(bases, exponents, results, count);
+    return;
+  }
+  for (size_t i = 0; i < count; ++i)
+    results[i] = modexp(bases[i], exponents[i], modulus);
+}
+
+// ----------------------------------------------------------------------------
+Montgomery::Montgomery(uint64_t modulus) : modulus_(modulus), inverse_(inverse64(modulus)) {
+  // 2^64 mod modulus, computed as (2^64 - modulus) mod modulus
+  this->one_ = (0 - modulus) % modulus;
+  this->r2_ = mulmod(this->one_, this->one_, modulus);
+}
+
+// ----------------------------------------------------------------------------
+uint64_t Montgomery::pow(uint64_t base, uint64_t exponent) const {
+  uint64_t result = this->one_;
+  if (exponent != 0) {
+    base = this->enter(base);
+    for (int bit = top_bit(exponent); bit >= 0; --bit) {
+      result = this->multiply(result, result);
+      if ((exponent >> bit) & 1)
+        result = this->multiply(result, base);
+    }
+  }
+  return this->leave(result);
+}
+
+// ----------------------------------------------------------------------------
+// Lanes exponentiations in lockstep over the bits of the longest exponent.
+// Shorter ones square their one until their own bits begin, and a lane
+// whose bit is clear computes the product anyway and keeps the square, so
+// the loop has no branch that depends on the exponents
+template <size_t Lanes>
+void Montgomery::powLanes(const uint64_t* bases, const uint64_t* exponents,
+                          uint64_t* results) const {
+  uint64_t base[Lanes];
+  uint64_t result[Lanes];
+  uint64_t longest = 0;
+  for (size_t i = 0; i < Lanes; ++i) {
+    base[i] = this->enter(bases[i]);
+    result[i] = this->one_;
+    longest |= exponents[i];
+  }
+
+  for (int bit = longest == 0 ? -1 : top_bit(longest); bit >= 0; --bit) {
+    for (size_t i = 0; i < Lanes; ++i) {
+      uint64_t square = this->multiply(result[i], result[i]);
+      uint64_t product = this->multiply(square, base[i]);
+      result[i] = ((exponents[i] >> bit) & 1) ? product : square;
+    }
+  }
+
+  for (size_t i = 0; i < Lanes; ++i)
+    results[i] = this->leave(result[i]);
+}
+
+// ----------------------------------------------------------------------------
+void Montgomery::pow(const uint64_t* bases, const uint64_t* exponents, uint64_t* results,
+                     size_t count) const {
+  size_t i = 0;
+  for (; i + kLanes <= count; i += kLanes)
+    this->powLanes<kLanes>(bases + i, exponents + i, results + i);
+  for (; i < count; ++i)
+    results[i] = this->pow(bases[i], exponents[i]);
+}
+
+// ----------------------------------------------------------------------------
+void Montgomery::pow(const uint64_t* bases, uint64_t exponent, uint64_t* results,
+                     size_t count) const {
+  // one exponent for all: every lane takes the same branch, so the branch
+  // is taken once per bit for a whole group
+  size_t i = 0;
+  for (; i + kLanes <= count; i += kLanes) {
+    uint64_t result[kLanes];
+    uint64_t base[kLanes];
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+      base[lane] = this->enter(bases[i + lane]);
+      result[lane] = this->one_;
+    }
+    for (int bit = exponent == 0 ? -1 : top_bit(exponent); bit >= 0; --bit) {
+      for (size_t lane = 0; lane < kLanes; ++lane)
+        result[lane] = this->multiply(result[lane], result[lane]);
+      if ((exponent >> bit) & 1) {
+        for (size_t lane = 0; lane < kLanes; ++lane)
+          result[lane] = this->multiply(result[lane], base[lane]);
+      }
+    }
+    for (size_t lane = 0; lane < kLanes; ++lane)
+      results[i + lane] = this->leave(result[lane]);
+  }
+  for (; i < count; ++i)
+    results[i] = this->pow(bases[i], exponent);
+}
+
+} // namespace DH
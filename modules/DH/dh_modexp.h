@@ -0,0 +1,86 @@
+#ifndef DH_MODEXP_H
+#define DH_MODEXP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DH {
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+// a * b mod modulus, exact for any 64-bit operands
+inline uint64_t mulmod(uint64_t a, uint64_t b, uint64_t modulus) {
+  return static_cast<uint64_t>(static_cast<uint128_t>(a) * b % modulus);
+}
+
+// odd^-1 mod 2^64. An odd number is its own inverse modulo 8, and every
+// Newton step doubles the number of correct low bits: 3, 6, 12, 24, 48, 96
+inline uint64_t inverse64(uint64_t odd) {
+  uint64_t inverse = odd;
+  for (int i = 0; i < 5; ++i)
+    inverse *= 2 - odd * inverse;
+  return inverse;
+}
+
+// base^exponent mod modulus by square-and-multiply, exact for any 64-bit
+// operands. modulus must not be 0
+uint64_t modexp(uint64_t base, uint64_t exponent, uint64_t modulus);
+
+// The same for count exponentiations under one modulus: results[i] =
+// bases[i]^exponents[i] mod modulus. Odd moduli (every prime but 2) go
+// through Montgomery, several exponentiations interleaved
+void modexp(const uint64_t* bases, const uint64_t* exponents, uint64_t* results,
+            size_t count, uint64_t modulus);
+
+// Montgomery arithmetic modulo one odd modulus, with R = 2^64. Setting up
+// costs a few multiplications and one division, after which every modular
+// multiplication is three multiplications and no division: worth keeping
+// around for a modulus that is used again, such as a Diffie-Hellman group.
+class Montgomery {
+ public:
+  // modulus must be odd
+  explicit Montgomery(uint64_t modulus);
+
+  uint64_t modulus() const { return this->modulus_; }
+
+  // in and out of Montgomery form, x R mod modulus
+  uint64_t enter(uint64_t x) const {
+    return this->reduce(static_cast<uint128_t>(x % this->modulus_) * this->r2_);
+  }
+  uint64_t leave(uint64_t x) const { return this->reduce(x); }
+  // the product of two values in Montgomery form, in Montgomery form
+  uint64_t multiply(uint64_t a, uint64_t b) const {
+    return this->reduce(static_cast<uint128_t>(a) * b);
+  }
+
+  // base^exponent mod modulus, plain in and out
+  uint64_t pow(uint64_t base, uint64_t exponent) const;
+  // count of them at once, with an exponent each or one for all of them
+  void pow(const uint64_t* bases, const uint64_t* exponents, uint64_t* results,
+           size_t count) const;
+  void pow(const uint64_t* bases, uint64_t exponent, uint64_t* results, size_t count) const;
+
+ private:
+  // t R^-1 mod modulus, for t < modulus * 2^64
+  uint64_t reduce(uint128_t t) const {
+    // m is chosen so that t - m * modulus is a multiple of 2^64: the low
+    // halves cancel exactly and only the high ones need subtracting
+    uint64_t m = static_cast<uint64_t>(t) * this->inverse_;
+    uint64_t high = static_cast<uint64_t>(t >> 64);
+    uint64_t mn = static_cast<uint64_t>((static_cast<uint128_t>(m) * this->modulus_) >> 64);
+    return high >= mn ? high - mn : high - mn + this->modulus_;
+  }
+
+  template <size_t Lanes>
+  void powLanes(const uint64_t* bases, const uint64_t* exponents, uint64_t* results) const;
+
+  uint64_t modulus_;
+  // modulus^-1 mod 2^64, R mod modulus (one, in Montgomery form) and R^2
+  uint64_t inverse_;
+  uint64_t one_;
+  uint64_t r2_;
+};
+
+} // namespace DH
+
+#endif // DH_MODEXP_H
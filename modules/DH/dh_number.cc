@@ -0,0 +1,117 @@
+#include "dh_number.h"
+
+#include <ctype.h>
+
+#include <utility>
+
+#include "dh_modexp.h"
+
+namespace DH {
+
+// ----------------------------------------------------------------------------
+Number::Number(uint64_t value) {
+  if (value != 0)
+    this->limbs_.push_back(value);
+}
+
+// ----------------------------------------------------------------------------
+Number::Number(std::vector<uint64_t> limbs) : limbs_(std::move(limbs)) {
+  this->trim();
+}
+
+// ----------------------------------------------------------------------------
+void Number::trim() {
+  while (!this->limbs_.empty() && this->limbs_.back() == 0)
+    this->limbs_.pop_back();
+}
+
+// ----------------------------------------------------------------------------
+bool Number::parse(const std::string& text, Number& out) {
+  bool hex = text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X');
+  size_t start = hex ? 2 : 0;
+  if (start == text.size())
+    return false;
+
+  // value = value * radix + digit, limb by limb
+  std::vector<uint64_t> limbs;
+  uint64_t radix = hex ? 16 : 10;
+  for (size_t i = start; i < text.size(); ++i) {
+    int c = static_cast<unsigned char>(text[i]);
+    uint64_t digit;
+    if (isdigit(c))
+      digit = c - '0';
+    else if (hex && isxdigit(c))
+      digit = tolower(c) - 'a' + 10;
+    else
+      return false;
+
+    uint64_t carry = digit;
+    for (uint64_t& limb : limbs) {
+      uint128_t product = static_cast<uint128_t>(limb) * radix + carry;
+      limb = static_cast<uint64_t>(product);
+      carry = static_cast<uint64_t>(product >> 64);
+    }
+    if (carry != 0)
+      limbs.push_back(carry);
+  }
+  out = Number(std::move(limbs));
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+Number Number::fromBytes(const uint8_t* bytes, size_t length) {
+  std::vector<uint64_t> limbs((length + 7) / 8, 0);
+  for (size_t i = 0; i < length; ++i) {
+    size_t position = length - 1 - i;
+    limbs[position / 8] |= static_cast<uint64_t>(bytes[i]) << (8 * (position % 8));
+  }
+  return Number(std::move(limbs));
+}
+
+// ----------------------------------------------------------------------------
+bool Number::toBytes(uint8_t* out, size_t width) const {
+  if ((this->bits() + 7) / 8 > width)
+    return false;
+  for (size_t i = 0; i < width; ++i) {
+    size_t position = width - 1 - i;
+    size_t limb = position / 8;
+    out[i] = limb < this->limbs_.size()
+        ? static_cast<uint8_t>(this->limbs_[limb] >> (8 * (position % 8))) : 0;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+size_t Number::bits() const {
+  if (this->limbs_.empty())
+    return 0;
+  return 64 * this->limbs_.size() - __builtin_clzll(this->limbs_.back());
+}
+
+// ----------------------------------------------------------------------------
+int Number::compare(const Number& other) const {
+  if (this->limbs_.size() != other.limbs_.size())
+    return this->limbs_.size() < other.limbs_.size() ? -1 : 1;
+  for (size_t i = this->limbs_.size(); i-- > 0;) {
+    if (this->limbs_[i] != other.limbs_[i])
+      return this->limbs_[i] < other.limbs_[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+std::ostream& operator<<(std::ostream& out, const Number& number) {
+  if (number.limbs().size() <= 1)
+    return out << number.low();
+
+  static const char kDigits[] = "0123456789abcdef";
+  std::string text = "0x";
+  for (size_t i = (number.bits() + 3) & ~static_cast<size_t>(3); i >= 4; i -= 4) {
+    size_t index = i - 4;
+    int digit = (number.limbs()[index / 64] >> (index % 64)) & 0xF;
+    text += kDigits[digit];
+  }
+  return out << text;
+}
+
+} // namespace DH
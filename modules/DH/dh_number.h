@@ -0,0 +1,58 @@
+#ifndef DH_NUMBER_H
+#define DH_NUMBER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace DH {
+
+// A non-negative integer of any size, as 64-bit limbs, least significant
+// first and without leading zero limbs. Only what Diffie-Hellman needs
+// around the arithmetic in Group: reading, writing and comparing.
+class Number {
+ public:
+  Number() {}
+  explicit Number(uint64_t value);
+  explicit Number(std::vector<uint64_t> limbs);
+
+  // decimal, or hexadecimal after 0x. false, and out untouched, if text is
+  // neither
+  static bool parse(const std::string& text, Number& out);
+
+  // big endian, the way values travel
+  static Number fromBytes(const uint8_t* bytes, size_t length);
+  // zero-padded to exactly width bytes; false if the value needs more
+  bool toBytes(uint8_t* out, size_t width) const;
+
+  size_t bits() const;
+  bool bit(size_t index) const {
+    size_t limb = index / 64;
+    return limb < this->limbs_.size() && ((this->limbs_[limb] >> (index % 64)) & 1);
+  }
+  bool isZero() const { return this->limbs_.empty(); }
+  // the least significant 64 bits
+  uint64_t low() const { return this->limbs_.empty() ? 0 : this->limbs_[0]; }
+  const std::vector<uint64_t>& limbs() const { return this->limbs_; }
+
+  // negative, zero or positive as this is less than, equal to or greater
+  // than other
+  int compare(const Number& other) const;
+  bool operator==(const Number& other) const { return this->limbs_ == other.limbs_; }
+  bool operator!=(const Number& other) const { return this->limbs_ != other.limbs_; }
+
+ private:
+  void trim();
+
+  std::vector<uint64_t> limbs_;
+};
+
+// decimal up to 64 bits, hexadecimal with 0x beyond
+std::ostream& operator<<(std::ostream& out, const Number& number);
+
+} // namespace DH
+
+#endif // DH_NUMBER_H
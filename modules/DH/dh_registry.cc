@@ -0,0 +1,271 @@
+#include "dh_registry.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+
+namespace DH {
+
+namespace {
+
+const char kMagic[8] = {'N', 'S', 'P', 'R', 'I', 'N', 'C', '1'};
+
+// ----------------------------------------------------------------------------
+uint16_t load16(const uint8_t* in) {
+  return static_cast<uint16_t>(in[0] | (in[1] << 8));
+}
+
+// ----------------------------------------------------------------------------
+uint32_t load32(const uint8_t* in) {
+  return load16(in) | (static_cast<uint32_t>(load16(in + 2)) << 16);
+}
+
+// ----------------------------------------------------------------------------
+uint64_t load64(const uint8_t* in) {
+  return load32(in) | (static_cast<uint64_t>(load32(in + 4)) << 32);
+}
+
+// ----------------------------------------------------------------------------
+void store16(uint8_t* out, uint16_t value) {
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+// ----------------------------------------------------------------------------
+void store64(uint8_t* out, uint64_t value) {
+  for (int i = 0; i < 8; ++i, value >>= 8)
+    out[i] = static_cast<uint8_t>(value);
+}
+
+// ----------------------------------------------------------------------------
+void append16(std::string& out, uint16_t value) {
+  uint8_t bytes[2];
+  store16(bytes, value);
+  out.append(reinterpret_cast<const char*>(bytes), 2);
+}
+
+// ----------------------------------------------------------------------------
+void appendNumber(std::string& out, const Number& number) {
+  size_t width = (number.bits() + 7) / 8;
+  std::vector<uint8_t> bytes(width);
+  number.toBytes(bytes.data(), width);
+  append16(out, static_cast<uint16_t>(width));
+  out.append(reinterpret_cast<const char*>(bytes.data()), width);
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+Registry::Registry(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nfailed to open " << path << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  this->size_ = info.st_size;
+  if (this->size_ < kRegistryHeaderSize) {
+    std::cerr << "ERROR: " << path << " is not a principal registry" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  void* memory = mmap(NULL, this->size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nmmap() failed" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  // lookups land anywhere, reading ahead only wastes memory
+  madvise(memory, this->size_, MADV_RANDOM);
+  this->data_ = static_cast<const uint8_t*>(memory);
+
+  // check everything the lookups rely on without reading the records
+  const uint8_t* header = this->data_;
+  this->principals_ = load64(header + 8);
+  uint64_t slots = load64(header + 16);
+  this->groups_ = load64(header + 24);
+  uint64_t index = load64(header + 32);
+  uint64_t group_table = load64(header + 40);
+  bool valid = memcmp(header, kMagic, sizeof(kMagic)) == 0 &&
+               load64(header + 48) == this->size_ &&
+               slots != 0 && (slots & (slots - 1)) == 0 && slots >= this->principals_ &&
+               index <= this->size_ && slots <= (this->size_ - index) / kRegistrySlotSize &&
+               group_table <= this->size_ && this->groups_ <= (this->size_ - group_table) / 8;
+  if (!valid) {
+    std::cerr << "ERROR: " << path << " is not a principal registry, or is damaged"
+              << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  this->mask_ = slots - 1;
+  this->index_ = this->data_ + index;
+  this->group_table_ = this->data_ + group_table;
+}
+
+// ----------------------------------------------------------------------------
+Registry::~Registry() {
+  munmap(const_cast<uint8_t*>(this->data_), this->size_);
+}
+
+// ----------------------------------------------------------------------------
+uint64_t Registry::hash(const char* name, size_t length) {
+  // FNV-1a, with its weak low bits mixed into the ones the index uses
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= static_cast<unsigned char>(name[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// ----------------------------------------------------------------------------
+bool Registry::at(uint64_t record, Principal& principal) const {
+  // a name, then four bytes of group, a key flag and two bytes of key
+  if (record < kRegistryHeaderSize || record >= this->size_)
+    return false;
+  const uint8_t* in = this->data_ + record;
+  size_t name_length = in[0];
+  if (this->size_ - record < 1 + name_length + 4 + 1 + 2)
+    return false;
+  principal.name = reinterpret_cast<const char*>(in + 1);
+  principal.name_length = name_length;
+  in += 1 + name_length;
+  principal.group = load32(in);
+  principal.has_key = in[4] != 0;
+  principal.key = load16(in + 5);
+  principal.record = record;
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+bool Registry::find(const char* name, size_t length, Principal& principal) const {
+  uint64_t hash = Registry::hash(name, length);
+  size_t i = hash & this->mask_;
+  for (size_t probes = 0; probes <= this->mask_; ++probes, i = (i + 1) & this->mask_) {
+    const uint8_t* slot = this->index_ + i * kRegistrySlotSize;
+    uint64_t record = load64(slot + 8);
+    if (record == 0)
+      return false;
+    if (load64(slot) == hash && this->at(record, principal) &&
+        principal.name_length == length && memcmp(principal.name, name, length) == 0)
+      return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+bool Registry::group(uint32_t index, Number& P, Number& G) const {
+  if (index >= this->groups_)
+    return false;
+  uint64_t record = load64(this->group_table_ + 8 * static_cast<size_t>(index));
+  for (Number* number : {&P, &G}) {
+    if (record > this->size_ - 2)
+      return false;
+    size_t width = load16(this->data_ + record);
+    if (this->size_ - record - 2 < width)
+      return false;
+    *number = Number::fromBytes(this->data_ + record + 2, width);
+    record += 2 + width;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+uint32_t RegistryBuilder::addGroup(const Number& P, const Number& G) {
+  std::string record;
+  appendNumber(record, P);
+  appendNumber(record, G);
+  std::map<std::string, uint32_t>::iterator it = this->group_indices_.find(record);
+  if (it != this->group_indices_.end())
+    return it->second;
+
+  uint32_t index = static_cast<uint32_t>(this->group_offsets_.size());
+  this->group_offsets_.push_back(this->group_records_.size());
+  this->group_records_ += record;
+  this->group_indices_.emplace(std::move(record), index);
+  return index;
+}
+
+// ----------------------------------------------------------------------------
+bool RegistryBuilder::add(const std::string& name, uint32_t group, bool has_key,
+                          uint16_t key) {
+  if (name.empty() || name.size() > kMaxPrincipalName || !this->names_.insert(name).second)
+    return false;
+
+  this->hashes_.push_back(Registry::hash(name.data(), name.size()));
+  this->offsets_.push_back(this->records_.size());
+  this->records_ += static_cast<char>(name.size());
+  this->records_ += name;
+  uint8_t fields[4 + 1 + 2];
+  store16(fields, static_cast<uint16_t>(group));
+  store16(fields + 2, static_cast<uint16_t>(group >> 16));
+  fields[4] = has_key ? 1 : 0;
+  store16(fields + 5, key);
+  this->records_.append(reinterpret_cast<const char*>(fields), sizeof(fields));
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+bool RegistryBuilder::write(const std::string& path) const {
+  // at most half full
+  uint64_t slots = 2;
+  while (slots < 2 * this->hashes_.size())
+    slots *= 2;
+
+  uint64_t group_table = kRegistryHeaderSize;
+  uint64_t group_base = group_table + 8 * this->group_offsets_.size();
+  uint64_t record_base = group_base + this->group_records_.size();
+  uint64_t index = (record_base + this->records_.size() + 7) & ~static_cast<uint64_t>(7);
+  uint64_t size = index + slots * kRegistrySlotSize;
+
+  std::vector<uint8_t> image(size, 0);
+  uint8_t* header = image.data();
+  memcpy(header, kMagic, sizeof(kMagic));
+  store64(header + 8, this->hashes_.size());
+  store64(header + 16, slots);
+  store64(header + 24, this->group_offsets_.size());
+  store64(header + 32, index);
+  store64(header + 40, group_table);
+  store64(header + 48, size);
+
+  for (size_t i = 0; i < this->group_offsets_.size(); ++i)
+    store64(&image[group_table + 8 * i], group_base + this->group_offsets_[i]);
+  memcpy(&image[group_base], this->group_records_.data(), this->group_records_.size());
+  memcpy(&image[record_base], this->records_.data(), this->records_.size());
+
+  uint64_t mask = slots - 1;
+  for (size_t i = 0; i < this->hashes_.size(); ++i) {
+    uint64_t slot = this->hashes_[i] & mask;
+    while (load64(&image[index + slot * kRegistrySlotSize + 8]) != 0)
+      slot = (slot + 1) & mask;
+    store64(&image[index + slot * kRegistrySlotSize], this->hashes_[i]);
+    store64(&image[index + slot * kRegistrySlotSize + 8], record_base + this->offsets_[i]);
+  }
+
+  // A KDC may have the old file mapped, so it is never truncated: the new
+  // one is written next to it and renamed over it once complete
+  std::string temporary = path + ".tmp";
+  unlink(temporary.c_str());
+  FILE* out = fopen(temporary.c_str(), "wbx");
+  if (out == NULL)
+    return false;
+  bool written = fwrite(image.data(), 1, image.size(), out) == image.size();
+  written = fclose(out) == 0 && written && rename(temporary.c_str(), path.c_str()) == 0;
+  if (!written) {
+    int error = errno;
+    unlink(temporary.c_str());
+    errno = error;
+  }
+  return written;
+}
+
+} // namespace DH
@@ -0,0 +1,115 @@
+#ifndef DH_REGISTRY_H
+#define DH_REGISTRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "dh_number.h"
+
+namespace DH {
+
+// A file of principals: each one's name, the group it does Diffie-Hellman
+// in and, optionally, the private key it registered with the server. Made
+// once by RegistryBuilder and mapped read-only by Registry, so that a server
+// starts in the same time for a million principals as for two, and only
+// touches the pages of the ones that turn up.
+//
+// Integers are little endian. The file is a 64-byte header
+//
+//   0  "NSPRINC1"       8  u64 principals     16  u64 index slots
+//   24 u64 groups       32  u64 index offset  40  u64 group table offset
+//   48 u64 file size    56  reserved
+//
+// then a table of u64 group record offsets, the group records (u16 length
+// and big-endian bytes of P, then of G), the principal records (u8 name
+// length and name, u32 group, u8 1 if a key follows, u16 key) and last the
+// index: a power of two of 16-byte slots, each the u64 hash of a name and
+// the u64 offset of its record, 0 if the slot is empty. It is filled by
+// linear probing to at most half, so a lookup reads one or two slots and
+// one record.
+const size_t kRegistryHeaderSize = 64;
+const size_t kRegistrySlotSize = 16;
+const size_t kMaxPrincipalName = 255;
+
+// what the registry says about one principal. name points into the mapping
+struct Principal {
+  const char* name;
+  size_t name_length;
+  uint32_t group;
+  bool has_key;
+  uint16_t key;
+  // where its record is, to find it again with Registry::at()
+  uint64_t record;
+};
+
+class Registry {
+ public:
+  // map the file at path, or print why not and exit
+  explicit Registry(const std::string& path);
+  ~Registry();
+
+  // copying and moving not allowed
+  Registry(const Registry& rhs) = delete;
+  Registry(Registry&& rhs) = delete;
+  Registry& operator=(const Registry& rhs) = delete;
+  Registry& operator=(Registry&& rhs) = delete;
+
+  size_t principals() const { return this->principals_; }
+  size_t groups() const { return this->groups_; }
+
+  bool find(const char* name, size_t length, Principal& principal) const;
+  bool find(const std::string& name, Principal& principal) const {
+    return this->find(name.data(), name.size(), principal);
+  }
+  // the principal whose record is at offset record, as find() returned it
+  bool at(uint64_t record, Principal& principal) const;
+  // P and G of a group; false if index or the record is out of bounds
+  bool group(uint32_t index, Number& P, Number& G) const;
+
+  static uint64_t hash(const char* name, size_t length);
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t principals_;
+  size_t groups_;
+  size_t mask_;
+  const uint8_t* index_;
+  const uint8_t* group_table_;
+};
+
+// Collects principals in memory, compactly enough for millions, and writes
+// the file Registry maps. Groups that several principals share are stored
+// once.
+class RegistryBuilder {
+ public:
+  // the index of the group, the same one for the same P and G
+  uint32_t addGroup(const Number& P, const Number& G);
+  // false if the name is taken, empty or too long
+  bool add(const std::string& name, uint32_t group, bool has_key, uint16_t key);
+  size_t principals() const { return this->hashes_.size(); }
+  size_t groups() const { return this->group_offsets_.size(); }
+
+  // false, with errno set, if the file cannot be written
+  bool write(const std::string& path) const;
+
+ private:
+  // group records, and where each starts
+  std::string group_records_;
+  std::vector<uint64_t> group_offsets_;
+  std::map<std::string, uint32_t> group_indices_;
+  // principal records, and the hash and start of each
+  std::string records_;
+  std::vector<uint64_t> hashes_;
+  std::vector<uint64_t> offsets_;
+  std::unordered_set<std::string> names_;
+};
+
+} // namespace DH
+
+#endif // DH_REGISTRY_H
@@ -0,0 +1,146 @@
+#include "dh_session_cache.h"
+
+namespace DH {
+
+// ----------------------------------------------------------------------------
+SessionCache::SessionCache(size_t memory, std::chrono::seconds ttl) : ttl_(ttl) {
+  // a power of two of slots, to probe with a mask, and indices that fit
+  // the recency links
+  size_t slots = 4;
+  while (slots * 2 * sizeof(Slot) <= memory && slots * 2 < kNone)
+    slots *= 2;
+  this->slots_.resize(slots);
+  for (Slot& slot : this->slots_)
+    slot.used = false;
+  this->mask_ = slots - 1;
+  this->limit_ = slots / 4 * 3;
+}
+
+// ----------------------------------------------------------------------------
+size_t SessionCache::home(uint64_t ticket) const {
+  // tickets are random when issued, but lookups are for whatever a client
+  // sends: mix before masking
+  ticket ^= ticket >> 33;
+  ticket *= 0xff51afd7ed558ccdULL;
+  ticket ^= ticket >> 33;
+  return static_cast<size_t>(ticket) & this->mask_;
+}
+
+// ----------------------------------------------------------------------------
+uint32_t SessionCache::locate(uint64_t ticket) const {
+  for (size_t i = this->home(ticket); this->slots_[i].used; i = (i + 1) & this->mask_) {
+    if (this->slots_[i].ticket == ticket)
+      return static_cast<uint32_t>(i);
+  }
+  return kNone;
+}
+
+// ----------------------------------------------------------------------------
+void SessionCache::unlink(uint32_t index) {
+  Slot& slot = this->slots_[index];
+  if (slot.older != kNone)
+    this->slots_[slot.older].newer = slot.newer;
+  else
+    this->oldest_ = slot.newer;
+  if (slot.newer != kNone)
+    this->slots_[slot.newer].older = slot.older;
+  else
+    this->newest_ = slot.older;
+}
+
+// ----------------------------------------------------------------------------
+void SessionCache::makeNewest(uint32_t index) {
+  Slot& slot = this->slots_[index];
+  slot.older = this->newest_;
+  slot.newer = kNone;
+  if (this->newest_ != kNone)
+    this->slots_[this->newest_].newer = index;
+  else
+    this->oldest_ = index;
+  this->newest_ = index;
+}
+
+// ----------------------------------------------------------------------------
+void SessionCache::relocate(uint32_t from, uint32_t to) {
+  Slot& slot = this->slots_[to];
+  slot = this->slots_[from];
+  this->slots_[from].used = false;
+  if (slot.older != kNone)
+    this->slots_[slot.older].newer = to;
+  else
+    this->oldest_ = to;
+  if (slot.newer != kNone)
+    this->slots_[slot.newer].older = to;
+  else
+    this->newest_ = to;
+}
+
+// ----------------------------------------------------------------------------
+void SessionCache::remove(uint32_t index) {
+  this->unlink(index);
+  this->slots_[index].used = false;
+  --this->size_;
+
+  // Close the gap. An entry further along the run may move into it unless
+  // its home lies between the gap and where it is now, in which case a
+  // lookup for it never passes the gap anyway
+  size_t gap = index;
+  for (size_t i = (index + 1) & this->mask_; this->slots_[i].used; i = (i + 1) & this->mask_) {
+    size_t distance = (i - this->home(this->slots_[i].ticket)) & this->mask_;
+    if (distance >= ((i - gap) & this->mask_)) {
+      this->relocate(static_cast<uint32_t>(i), static_cast<uint32_t>(gap));
+      gap = i;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+void SessionCache::insert(uint64_t ticket, const CachedSession& session) {
+  Clock::time_point expires = Clock::now() + this->ttl_;
+  uint32_t index = this->locate(ticket);
+  if (index != kNone) {
+    this->slots_[index].session = session;
+    this->slots_[index].expires = expires;
+    this->unlink(index);
+    this->makeNewest(index);
+    return;
+  }
+
+  if (this->size_ == this->limit_)
+    this->remove(this->oldest_);
+  size_t i = this->home(ticket);
+  while (this->slots_[i].used)
+    i = (i + 1) & this->mask_;
+
+  Slot& slot = this->slots_[i];
+  slot.ticket = ticket;
+  slot.session = session;
+  slot.expires = expires;
+  slot.used = true;
+  this->makeNewest(static_cast<uint32_t>(i));
+  ++this->size_;
+}
+
+// ----------------------------------------------------------------------------
+bool SessionCache::find(uint64_t ticket, CachedSession& session) {
+  uint32_t index = this->locate(ticket);
+  if (index == kNone)
+    return false;
+  if (Clock::now() >= this->slots_[index].expires) {
+    this->remove(index);
+    return false;
+  }
+  this->unlink(index);
+  this->makeNewest(index);
+  session = this->slots_[index].session;
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+void SessionCache::erase(uint64_t ticket) {
+  uint32_t index = this->locate(ticket);
+  if (index != kNone)
+    this->remove(index);
+}
+
+} // namespace DH
@@ -0,0 +1,93 @@
+#ifndef DH_SESSION_CACHE_H
+#define DH_SESSION_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <vector>
+
+namespace DH {
+
+// what a server keeps of a finished exchange for the client to resume with
+struct CachedSession {
+  // who the key was agreed with, in whatever terms the server names clients
+  uint64_t principal;
+  // where the server keeps the rest of what it knows about the client, if
+  // anywhere, say its record in a Registry
+  uint64_t record;
+  uint8_t role;
+  uint16_t session_key;
+};
+
+// Session keys by resumption ticket, so that a returning client can skip
+// the exchange.
+//
+// The table is one array of slots, sized once from a memory budget, with
+// open addressing: linear probing, and removal by shifting the rest of the
+// run back, so there are no tombstones and lookups stay short. It is never
+// more than three quarters full; past that the least recently used entry
+// makes room. The recency list runs through the slots themselves, by index.
+// An entry expires a fixed time after it was inserted however often it is
+// used, so no session key outlives the ttl.
+class SessionCache {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // slots for at most memory bytes, but room for a few entries regardless
+  SessionCache(size_t memory, std::chrono::seconds ttl);
+
+  // copying and moving not allowed
+  SessionCache(const SessionCache& rhs) = delete;
+  SessionCache(SessionCache&& rhs) = delete;
+  SessionCache& operator=(const SessionCache& rhs) = delete;
+  SessionCache& operator=(SessionCache&& rhs) = delete;
+
+  // add the session under ticket, or replace what is there and start its
+  // ttl over
+  void insert(uint64_t ticket, const CachedSession& session);
+  // the session under ticket, unless there is none or it has expired. A hit
+  // becomes the most recently used entry
+  bool find(uint64_t ticket, CachedSession& session);
+  void erase(uint64_t ticket);
+
+  size_t size() const { return this->size_; }
+  // entries held before the least recently used is evicted
+  size_t capacity() const { return this->limit_; }
+  size_t memory() const { return this->slots_.size() * sizeof(Slot); }
+  std::chrono::seconds ttl() const { return this->ttl_; }
+
+ private:
+  static const uint32_t kNone = ~static_cast<uint32_t>(0);
+
+  struct Slot {
+    uint64_t ticket;
+    CachedSession session;
+    Clock::time_point expires;
+    // neighbours in the recency list, kNone past either end
+    uint32_t older;
+    uint32_t newer;
+    bool used;
+  };
+
+  size_t home(uint64_t ticket) const;
+  // the slot holding ticket, or kNone
+  uint32_t locate(uint64_t ticket) const;
+  void unlink(uint32_t index);
+  void makeNewest(uint32_t index);
+  void remove(uint32_t index);
+  // the entry in slot from moves to the empty slot to
+  void relocate(uint32_t from, uint32_t to);
+
+  std::vector<Slot> slots_;
+  size_t mask_;
+  size_t limit_;
+  size_t size_ = 0;
+  std::chrono::seconds ttl_;
+  uint32_t oldest_ = kNone;
+  uint32_t newest_ = kNone;
+};
+
+} // namespace DH
+
+#endif // DH_SESSION_CACHE_H
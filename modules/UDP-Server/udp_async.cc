@@ -0,0 +1,351 @@
+#include "udp_async.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+namespace UDP {
+
+// ----------------------------------------------------------------------------
+Scheduler::~Scheduler() {
+  // tasks still suspended somewhere go down with their frames
+  for (void* frame : this->spawned_)
+    std::coroutine_handle<>::from_address(frame).destroy();
+  if (this->timer_fd_ >= 0) {
+    this->reactor_.unwatch(this->timer_fd_);
+    close(this->timer_fd_);
+  }
+}
+
+// ----------------------------------------------------------------------------
+void Scheduler::spawn(Task<void> task) {
+  Task<void>::Handle handle = task.release();
+  handle.promise().scheduler = this;
+  this->spawned_.insert(handle.address());
+  this->ready_.push_back(handle);
+}
+
+// ----------------------------------------------------------------------------
+void Scheduler::finished(std::coroutine_handle<> handle) {
+  // still inside the task's final suspend, it is freed from run()
+  this->finished_.push_back(handle);
+}
+
+// ----------------------------------------------------------------------------
+void Scheduler::reap() {
+  for (std::coroutine_handle<> handle : this->finished_) {
+    auto typed = Task<void>::Handle::from_address(handle.address());
+    if (typed.promise().error)
+      std::cerr << "ERROR: spawned task ended with an exception" << std::endl;
+    this->spawned_.erase(handle.address());
+    handle.destroy();
+  }
+  this->finished_.clear();
+}
+
+// ----------------------------------------------------------------------------
+void Scheduler::run() {
+  this->stopped_ = false;
+  while (!this->stopped_ && !this->spawned_.empty()) {
+    while (!this->ready_.empty() && !this->stopped_) {
+      std::coroutine_handle<> handle = this->ready_.front();
+      this->ready_.pop_front();
+      handle.resume();
+      this->reap();
+    }
+    if (this->stopped_ || this->spawned_.empty())
+      break;
+
+    // nothing left to run: wait for a socket or a timer to wake somebody
+    if (this->reactor_.runOnce() < 0)
+      break;
+  }
+}
+
+// ----------------------------------------------------------------------------
+bool Scheduler::arm(Deadline& deadline, std::chrono::milliseconds interval) {
+  if (this->timer_fd_ < 0) {
+    this->timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (this->timer_fd_ < 0) {
+      std::cerr << "ERROR: " << strerror(errno) << "\ntimerfd_create() failed" << std::endl;
+      return false;
+    }
+    if (!this->reactor_.watch(this->timer_fd_, [this]() { this->expire(); })) {
+      close(this->timer_fd_);
+      this->timer_fd_ = -1;
+      return false;
+    }
+  }
+
+  deadline.when = std::chrono::steady_clock::now() + interval;
+  this->deadlines_.push_back(&deadline);
+  this->place(this->deadlines_.size() - 1, &deadline);
+  this->siftUp(deadline.slot);
+  // only a new earliest deadline moves the timer
+  if (deadline.slot == 0)
+    this->setTimer();
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+void Scheduler::cancel(Deadline& deadline) {
+  if (!deadline.armed())
+    return;
+  size_t slot = deadline.slot;
+  Deadline* last = this->deadlines_.back();
+  this->deadlines_.pop_back();
+  deadline.slot = Deadline::kUnarmed;
+  if (last != &deadline) {
+    this->place(slot, last);
+    this->siftUp(slot);
+    this->siftDown(last->slot);
+  }
+  // the timer may now go off early, expire() then just sets it again
+}
+
+// ----------------------------------------------------------------------------
+void Scheduler::expire() {
+  uint64_t expirations;
+  while (read(this->timer_fd_, &expirations, sizeof expirations) > 0) {
+  }
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  while (!this->deadlines_.empty() && this->deadlines_[0]->when <= now) {
+    Deadline* due = this->deadlines_[0];
+    this->cancel(*due);
+    due->on_expiry(due->context);
+  }
+  this->setTimer();
+}
+
+// ----------------------------------------------------------------------------
+void Scheduler::setTimer() {
+  // all zero disarms the timer
+  struct itimerspec spec = {};
+  if (!this->deadlines_.empty()) {
+    std::chrono::nanoseconds when = this->deadlines_[0]->when.time_since_epoch();
+    spec.it_value.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(when).count();
+    spec.it_value.tv_nsec = (when % std::chrono::seconds(1)).count();
+    // a deadline at the clock's epoch would read as disarming
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+      spec.it_value.tv_nsec = 1;
+  }
+  timerfd_settime(this->timer_fd_, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+// ----------------------------------------------------------------------------
+void Scheduler::place(size_t slot, Deadline* deadline) {
+  this->deadlines_[slot] = deadline;
+  deadline->slot = slot;
+}
+
+// ----------------------------------------------------------------------------
+void Scheduler::siftUp(size_t slot) {
+  Deadline* deadline = this->deadlines_[slot];
+  while (slot > 0) {
+    size_t parent = (slot - 1) / 2;
+    if (this->deadlines_[parent]->when <= deadline->when)
+      break;
+    this->place(slot, this->deadlines_[parent]);
+    slot = parent;
+  }
+  this->place(slot, deadline);
+}
+
+// ----------------------------------------------------------------------------
+void Scheduler::siftDown(size_t slot) {
+  Deadline* deadline = this->deadlines_[slot];
+  size_t size = this->deadlines_.size();
+  while (2 * slot + 1 < size) {
+    size_t child = 2 * slot + 1;
+    if (child + 1 < size && this->deadlines_[child + 1]->when < this->deadlines_[child]->when)
+      ++child;
+    if (deadline->when <= this->deadlines_[child]->when)
+      break;
+    this->place(slot, this->deadlines_[child]);
+    slot = child;
+  }
+  this->place(slot, deadline);
+}
+
+// ----------------------------------------------------------------------------
+bool Scheduler::SleepAwaiter::await_suspend(std::coroutine_handle<> awaiter) {
+  this->handle = awaiter;
+  this->deadline.on_expiry = [](void* context) {
+    SleepAwaiter* sleeper = static_cast<SleepAwaiter*>(context);
+    sleeper->scheduler->schedule(sleeper->handle);
+  };
+  this->deadline.context = this;
+  // without a timer there is nothing to wait for, carry on at once
+  return this->scheduler->arm(this->deadline, this->interval);
+}
+
+// ----------------------------------------------------------------------------
+AsyncServer::AsyncServer(Scheduler& scheduler, Server& server)
+    : scheduler_(scheduler), server_(server), scratch_(kMaxBuffer) {
+  this->server_.setBlocking(false);
+  this->scheduler_.reactor().watch(this->server_.getSocketDescriptor(), [this]() {
+    this->drain();
+  });
+}
+
+// ----------------------------------------------------------------------------
+AsyncServer::~AsyncServer() {
+  this->scheduler_.reactor().unwatch(this->server_.getSocketDescriptor());
+}
+
+// ----------------------------------------------------------------------------
+uint64_t AsyncServer::keyOf(const struct sockaddr_in& address) {
+  return (static_cast<uint64_t>(ntohl(address.sin_addr.s_addr)) << 16) |
+         ntohs(address.sin_port);
+}
+
+// ----------------------------------------------------------------------------
+AsyncServer::ReceiveAwaiter AsyncServer::asyncReceive() {
+  return ReceiveAwaiter{this, kAnySender, std::chrono::milliseconds(0)};
+}
+
+// ----------------------------------------------------------------------------
+AsyncServer::ReceiveAwaiter AsyncServer::asyncReceive(const struct sockaddr_in& peer) {
+  this->open(peer);
+  return ReceiveAwaiter{this, keyOf(peer), std::chrono::milliseconds(0)};
+}
+
+// ----------------------------------------------------------------------------
+AsyncServer::TimedReceive AsyncServer::asyncReceive(const struct sockaddr_in& peer,
+                                                    Datagram& datagram,
+                                                    std::chrono::milliseconds timeout) {
+  this->open(peer);
+  return TimedReceive{ReceiveAwaiter{this, keyOf(peer), timeout}, &datagram};
+}
+
+// ----------------------------------------------------------------------------
+AsyncServer::Mailbox* AsyncServer::mailbox(uint64_t key) {
+  if (key == kAnySender)
+    return &this->any_;
+  std::unordered_map<uint64_t, Mailbox>::iterator it = this->mailboxes_.find(key);
+  return it == this->mailboxes_.end() ? nullptr : &it->second;
+}
+
+// ----------------------------------------------------------------------------
+void AsyncServer::open(const struct sockaddr_in& peer) {
+  uint64_t key = keyOf(peer);
+  if (this->mailboxes_.count(key) != 0)
+    return;
+  Mailbox& mailbox = this->mailboxes_[key];
+
+  // claim what the peer sent before anybody asked for it
+  std::deque<Datagram>& any = this->any_.queued;
+  for (std::deque<Datagram>::iterator it = any.begin(); it != any.end();) {
+    if (keyOf(it->address) == key) {
+      mailbox.queued.push_back(std::move(*it));
+      it = any.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+void AsyncServer::close(const struct sockaddr_in& peer) {
+  std::unordered_map<uint64_t, Mailbox>::iterator it = this->mailboxes_.find(keyOf(peer));
+  if (it == this->mailboxes_.end())
+    return;
+
+  // whoever still waits wakes up empty handed
+  for (ReceiveAwaiter* awaiter : it->second.waiting) {
+    this->scheduler_.cancel(awaiter->deadline);
+    this->scheduler_.schedule(awaiter->handle);
+  }
+  this->mailboxes_.erase(it);
+}
+
+// ----------------------------------------------------------------------------
+void AsyncServer::drain() {
+  // edge triggered: keep going until the socket says EAGAIN
+  Buffer buffer;
+  buffer.data = this->scratch_.data();
+  buffer.capacity = this->scratch_.size();
+  while (true) {
+    if (this->server_.receive(buffer) < 0) {
+      // a refused earlier send is reported once, the queue is still there
+      if (errno == ECONNREFUSED || errno == EINTR)
+        continue;
+      return;
+    }
+
+    Datagram datagram;
+    datagram.payload.assign(reinterpret_cast<char*>(buffer.data), buffer.length);
+    datagram.address = buffer.address;
+
+    Mailbox* mailbox = this->mailbox(keyOf(datagram.address));
+    this->deliver(mailbox != nullptr ? *mailbox : this->any_, datagram);
+  }
+}
+
+// ----------------------------------------------------------------------------
+void AsyncServer::deliver(Mailbox& mailbox, Datagram& datagram) {
+  if (mailbox.waiting.empty()) {
+    if (&mailbox == &this->any_ && mailbox.queued.size() == kMaxUnclaimed)
+      mailbox.queued.pop_front();
+    mailbox.queued.push_back(std::move(datagram));
+    return;
+  }
+
+  ReceiveAwaiter* awaiter = mailbox.waiting.front();
+  mailbox.waiting.pop_front();
+  this->scheduler_.cancel(awaiter->deadline);
+  awaiter->result = std::move(datagram);
+  awaiter->received = true;
+  this->scheduler_.schedule(awaiter->handle);
+}
+
+// ----------------------------------------------------------------------------
+void AsyncServer::expire(void* context) {
+  // the scheduler has taken the deadline off its heap already
+  ReceiveAwaiter* awaiter = static_cast<ReceiveAwaiter*>(context);
+  AsyncServer* server = awaiter->owner;
+  Mailbox* mailbox = server->mailbox(awaiter->key);
+  if (mailbox != nullptr) {
+    std::deque<ReceiveAwaiter*>& waiting = mailbox->waiting;
+    waiting.erase(std::remove(waiting.begin(), waiting.end(), awaiter), waiting.end());
+  }
+  server->scheduler_.schedule(awaiter->handle);
+}
+
+// ----------------------------------------------------------------------------
+bool AsyncServer::ReceiveAwaiter::await_ready() {
+  Mailbox* mailbox = this->owner->mailbox(this->key);
+  if (mailbox == nullptr || mailbox->queued.empty())
+    return false;
+
+  this->result = std::move(mailbox->queued.front());
+  mailbox->queued.pop_front();
+  this->received = true;
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+bool AsyncServer::ReceiveAwaiter::await_suspend(std::coroutine_handle<> awaiter) {
+  this->handle = awaiter;
+  Mailbox* mailbox = this->owner->mailbox(this->key);
+  // closed in the meantime, nothing will ever come
+  if (mailbox == nullptr)
+    return false;
+
+  if (this->timeout.count() > 0) {
+    this->deadline.on_expiry = &AsyncServer::expire;
+    this->deadline.context = this;
+    // without a timer the bound cannot be kept, so time out right away
+    if (!this->owner->scheduler_.arm(this->deadline, this->timeout))
+      return false;
+  }
+  mailbox->waiting.push_back(this);
+  return true;
+}
+
+} // namespace UDP
@@ -0,0 +1,320 @@
+#ifndef UDP_ASYNC_H
+#define UDP_ASYNC_H
+
+// C++20 coroutine layer over UDP::Server. Only built as the udp_async
+// library when the compiler supports C++20; the rest of the project is
+// C++14 and must not include this header.
+
+#include <stdint.h>
+
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "udp_reactor.h"
+#include "udp_server.h"
+
+namespace UDP {
+
+class Scheduler;
+
+// A coroutine that starts when it is awaited (or spawned) and hands its
+// result to whoever awaits it:
+//
+//   Task<int> step(AsyncServer& server) {
+//     Datagram request = co_await server.asyncReceive();
+//     ...
+//     co_return 42;
+//   }
+//   int value = co_await step(server);
+template <typename T>
+class Task;
+
+// A moment a suspended coroutine waits for. It lives in the awaiter, so it
+// costs no allocation; the scheduler keeps pointers to the armed ones in a
+// heap, and each knows its slot there so it can be cancelled in O(log n).
+// Must not move while armed.
+struct Deadline {
+  std::chrono::steady_clock::time_point when{};
+  // what expiry does, with the context it was armed with
+  void (*on_expiry)(void* context) = nullptr;
+  void* context = nullptr;
+  // index in the scheduler's heap, kUnarmed when not in it
+  size_t slot = kUnarmed;
+
+  static const size_t kUnarmed = ~static_cast<size_t>(0);
+  bool armed() const { return slot != kUnarmed; }
+};
+
+namespace detail {
+
+// ----------------------------------------------------------------------------
+struct PromiseBase {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+  // set for tasks handed to Scheduler::spawn, nobody awaits those
+  Scheduler* scheduler = nullptr;
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept;
+    void await_resume() noexcept {}
+  };
+  FinalAwaiter final_suspend() noexcept { return {}; }
+};
+
+// ----------------------------------------------------------------------------
+template <typename T>
+struct Promise : PromiseBase {
+  T value;
+  Task<T> get_return_object();
+  void return_value(T result) { value = std::move(result); }
+};
+
+// ----------------------------------------------------------------------------
+template <>
+struct Promise<void> : PromiseBase {
+  Task<void> get_return_object();
+  void return_void() {}
+};
+
+} // namespace detail
+
+// ----------------------------------------------------------------------------
+template <typename T = void>
+class Task {
+ public:
+  typedef detail::Promise<T> promise_type;
+  typedef std::coroutine_handle<promise_type> Handle;
+
+  explicit Task(Handle handle) : handle_(handle) {}
+  Task(Task&& rhs) noexcept : handle_(std::exchange(rhs.handle_, nullptr)) {}
+  ~Task() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  // copying not allowed
+  Task(const Task& rhs) = delete;
+  Task& operator=(const Task& rhs) = delete;
+  Task& operator=(Task&& rhs) = delete;
+
+  // awaiting starts the task and resumes the awaiter once it is done
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    handle_.promise().continuation = awaiter;
+    return handle_;
+  }
+  T await_resume() {
+    if (handle_.promise().error)
+      std::rethrow_exception(handle_.promise().error);
+    if constexpr (!std::is_void<T>::value)
+      return std::move(handle_.promise().value);
+  }
+
+  // give up ownership, for Scheduler::spawn
+  Handle release() { return std::exchange(handle_, nullptr); }
+
+ private:
+  Handle handle_;
+};
+
+// Runs coroutines on the calling thread. Spawned tasks are resumed from a
+// ready queue; when nothing is ready the scheduler waits on its Reactor for
+// sockets and its deadlines. All deadlines share one timerfd, armed for the
+// earliest of them, so thousands of tasks can be in flight and waiting with
+// a timeout, each costing one coroutine frame.
+class Scheduler {
+ public:
+  Scheduler() = default;
+  ~Scheduler();
+
+  // copying and moving not allowed
+  Scheduler(const Scheduler& rhs) = delete;
+  Scheduler(Scheduler&& rhs) = delete;
+  Scheduler& operator=(const Scheduler& rhs) = delete;
+  Scheduler& operator=(Scheduler&& rhs) = delete;
+
+  // start a task nobody awaits; the scheduler frees it when it finishes
+  void spawn(Task<void> task);
+  // resume handle on the next pass of the ready queue
+  void schedule(std::coroutine_handle<> handle) { ready_.push_back(handle); }
+
+  // run until every spawned task has finished or stop() is called
+  void run();
+  void stop() { stopped_ = true; }
+  size_t alive() const { return spawned_.size(); }
+
+  Reactor& reactor() { return reactor_; }
+
+  // Call deadline.on_expiry(deadline.context) after interval, unless it is
+  // cancelled first. Returns false if the timerfd cannot be created.
+  bool arm(Deadline& deadline, std::chrono::milliseconds interval);
+  void cancel(Deadline& deadline);
+
+  // co_await scheduler.sleep(std::chrono::milliseconds(10));
+  struct SleepAwaiter {
+    Scheduler* scheduler;
+    std::chrono::milliseconds interval;
+    std::coroutine_handle<> handle{};
+    Deadline deadline{};
+    bool await_ready() const noexcept { return interval.count() <= 0; }
+    bool await_suspend(std::coroutine_handle<> awaiter);
+    void await_resume() const noexcept {}
+  };
+  SleepAwaiter sleep(std::chrono::milliseconds interval) { return SleepAwaiter{this, interval}; }
+
+ private:
+  friend struct detail::PromiseBase;
+  void finished(std::coroutine_handle<> handle);
+  void reap();
+  // run what is due and set the timerfd for what is left
+  void expire();
+  void setTimer();
+  // heap order on when, earliest at the top
+  void place(size_t slot, Deadline* deadline);
+  void siftUp(size_t slot);
+  void siftDown(size_t slot);
+
+  Reactor reactor_;
+  // one timerfd for every deadline, -1 until the first is armed
+  int timer_fd_ = -1;
+  std::vector<Deadline*> deadlines_;
+  std::deque<std::coroutine_handle<>> ready_;
+  // frame addresses of the spawned tasks that have not finished
+  std::unordered_set<void*> spawned_;
+  std::vector<std::coroutine_handle<>> finished_;
+  bool stopped_ = false;
+};
+
+// Coroutine receives on one Server. Datagrams are routed by sender: a peer
+// with an open mailbox (see open()) gets its own queue, so one socket can
+// carry many concurrent handshakes, each written as a straight-line
+// coroutine. Datagrams from anybody else go to asyncReceive().
+class AsyncServer {
+ public:
+  // Makes server non-blocking and watches it on the scheduler's reactor.
+  // Destroy it before the scheduler.
+  AsyncServer(Scheduler& scheduler, Server& server);
+  ~AsyncServer();
+
+  // copying and moving not allowed
+  AsyncServer(const AsyncServer& rhs) = delete;
+  AsyncServer(AsyncServer&& rhs) = delete;
+  AsyncServer& operator=(const AsyncServer& rhs) = delete;
+  AsyncServer& operator=(AsyncServer&& rhs) = delete;
+
+  // what co_await on a receive works with
+  struct ReceiveAwaiter {
+    AsyncServer* owner;
+    uint64_t key;  // kAnySender or a peer
+    std::chrono::milliseconds timeout;  // zero waits forever
+    Datagram result{};
+    bool received = false;
+    Deadline deadline{};
+    std::coroutine_handle<> handle{};
+
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> awaiter);
+    Datagram await_resume() { return std::move(result); }
+  };
+
+  // the timeout form resumes with whether a datagram arrived in time
+  struct TimedReceive {
+    ReceiveAwaiter awaiter;
+    Datagram* target;
+
+    bool await_ready() { return awaiter.await_ready(); }
+    bool await_suspend(std::coroutine_handle<> handle) { return awaiter.await_suspend(handle); }
+    bool await_resume() {
+      if (awaiter.received)
+        *target = std::move(awaiter.result);
+      return awaiter.received;
+    }
+  };
+
+  // Datagram d = co_await server.asyncReceive();
+  // next datagram from a sender without a mailbox
+  ReceiveAwaiter asyncReceive();
+  // next datagram from peer, opening its mailbox if needed
+  ReceiveAwaiter asyncReceive(const struct sockaddr_in& peer);
+  // the same, but gives up after timeout:
+  //   if (!co_await server.asyncReceive(peer, datagram, 200ms)) ... retry
+  TimedReceive asyncReceive(const struct sockaddr_in& peer, Datagram& datagram,
+                            std::chrono::milliseconds timeout);
+
+  // Route everything from peer to its own queue from now on, including
+  // whatever of it is already waiting for asyncReceive()
+  void open(const struct sockaddr_in& peer);
+  // drop the mailbox and anything still queued in it
+  void close(const struct sockaddr_in& peer);
+
+  void send(const struct sockaddr_in& destination, const std::string& payload) {
+    server_.send(destination, payload.data(), payload.size());
+  }
+  Server& server() { return server_; }
+
+ private:
+  struct Mailbox {
+    std::deque<Datagram> queued;
+    std::deque<ReceiveAwaiter*> waiting;
+  };
+
+  static const uint64_t kAnySender = ~0ULL;
+  // datagrams from senders without a mailbox that wait for asyncReceive();
+  // past that the oldest are dropped, so nobody can make the queue grow
+  static const size_t kMaxUnclaimed = 1024;
+
+  static uint64_t keyOf(const struct sockaddr_in& address);
+  Mailbox* mailbox(uint64_t key);
+  void drain();
+  void deliver(Mailbox& mailbox, Datagram& datagram);
+  static void expire(void* awaiter);
+
+  Scheduler& scheduler_;
+  Server& server_;
+  Mailbox any_;
+  std::unordered_map<uint64_t, Mailbox> mailboxes_;
+  std::vector<uint8_t> scratch_;
+};
+
+namespace detail {
+
+// ----------------------------------------------------------------------------
+template <typename Promise>
+std::coroutine_handle<> PromiseBase::FinalAwaiter::await_suspend(
+    std::coroutine_handle<Promise> handle) noexcept {
+  PromiseBase& promise = handle.promise();
+  if (promise.continuation)
+    return promise.continuation;
+  if (promise.scheduler != nullptr)
+    promise.scheduler->finished(handle);
+  return std::noop_coroutine();
+}
+
+// ----------------------------------------------------------------------------
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+// ----------------------------------------------------------------------------
+inline Task<void> Promise<void>::get_return_object() {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+} // namespace UDP
+
+#endif // UDP_ASYNC_H
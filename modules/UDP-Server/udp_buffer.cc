@@ -0,0 +1,36 @@
+#include "udp_buffer.h"
+
+#include <string.h>
+
+namespace UDP {
+
+// ----------------------------------------------------------------------------
+BufferPool::BufferPool(size_t count, size_t size)
+    : storage_(count * size), buffers_(count) {
+  this->free_.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    Buffer& buffer = this->buffers_[i];
+    memset(&buffer, 0, sizeof buffer);
+    buffer.data = this->storage_.data() + i * size;
+    buffer.capacity = size;
+    this->free_.push_back(&buffer);
+  }
+}
+
+// ----------------------------------------------------------------------------
+Buffer* BufferPool::acquire() {
+  if (this->free_.empty())
+    return NULL;
+
+  Buffer* buffer = this->free_.back();
+  this->free_.pop_back();
+  buffer->length = 0;
+  return buffer;
+}
+
+// ----------------------------------------------------------------------------
+void BufferPool::release(Buffer* buffer) {
+  this->free_.push_back(buffer);
+}
+
+} // namespace UDP
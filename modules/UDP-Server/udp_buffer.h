@@ -0,0 +1,49 @@
+#ifndef UDP_BUFFER_H
+#define UDP_BUFFER_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace UDP {
+  extern const int kMaxBuffer;
+
+// Caller-owned memory for one datagram. Server::receive writes straight
+// into `data` and fills in `length` and the sender's `address`.
+struct Buffer {
+  uint8_t* data;
+  size_t capacity;
+  size_t length;
+  struct sockaddr_in address;
+};
+
+// Fixed set of equally sized buffers carved out of one allocation, so a
+// relay can hold on to datagrams without copying or allocating per message.
+// Not thread safe: give each thread its own pool.
+class BufferPool {
+ public:
+  BufferPool(size_t count, size_t size = kMaxBuffer);
+  ~BufferPool() = default;
+
+  // copying and moving not allowed
+  BufferPool(const BufferPool& rhs) = delete;
+  BufferPool(BufferPool&& rhs) = delete;
+  BufferPool& operator=(const BufferPool& rhs) = delete;
+  BufferPool& operator=(BufferPool&& rhs) = delete;
+
+  // NULL when every buffer is in use
+  Buffer* acquire();
+  void release(Buffer* buffer);
+  size_t available() const { return free_.size(); }
+
+ private:
+  std::vector<uint8_t> storage_;
+  std::vector<Buffer> buffers_;
+  std::vector<Buffer*> free_;
+};
+
+} // namespace UDP
+
+#endif // UDP_BUFFER_H
@@ -0,0 +1,65 @@
+#include "udp_frame.h"
+
+#include <iostream>
+
+namespace UDP {
+
+// ----------------------------------------------------------------------------
+bool parseFrame(const void* data, size_t size, Frame& frame) {
+  const uint8_t* in = static_cast<const uint8_t*>(data);
+  if (size < kFrameHeaderSize || in[0] != kFrameVersion)
+    return false;
+
+  frame.header.version = in[0];
+  frame.header.type = static_cast<MessageType>(in[1]);
+  frame.header.length = getU16(in + 2);
+  frame.header.session = getU32(in + 4);
+  frame.header.sequence = getU64(in + 8);
+  if (frame.header.length != size - kFrameHeaderSize)
+    return false;
+
+  frame.payload = in + kFrameHeaderSize;
+  frame.length = frame.header.length;
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+bool parseFrame(const std::string& datagram, Frame& frame) {
+  return parseFrame(datagram.data(), datagram.size(), frame);
+}
+
+// ----------------------------------------------------------------------------
+void buildFrame(std::string& out, MessageType type, uint32_t session, uint64_t sequence,
+                const void* payload, size_t length) {
+  uint8_t header[kFrameHeaderSize];
+  header[0] = kFrameVersion;
+  header[1] = static_cast<uint8_t>(type);
+  putU16(header + 2, static_cast<uint16_t>(length));
+  putU32(header + 4, session);
+  putU64(header + 8, sequence);
+
+  out.assign(reinterpret_cast<const char*>(header), kFrameHeaderSize);
+  out.append(static_cast<const char*>(payload), length);
+}
+
+// ----------------------------------------------------------------------------
+bool receiveFrame(Server& server, std::string& buffer, MessageType type, uint32_t session,
+                  size_t length, Frame& frame) {
+  while (server.receive(buffer)) {
+    if (!parseFrame(buffer, frame)) {
+      std::cerr << "ERROR: dropped a malformed frame" << std::endl;
+      continue;
+    }
+    if (frame.header.type != type ||
+        (session != kAnySession && frame.header.session != session) ||
+        (length != kAnyLength && frame.length != length)) {
+      std::cerr << "ERROR: dropped an unexpected frame of type "
+                << static_cast<int>(frame.header.type) << std::endl;
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+} // namespace UDP
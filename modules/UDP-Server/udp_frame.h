@@ -0,0 +1,127 @@
+#ifndef UDP_FRAME_H
+#define UDP_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "udp_server.h"
+
+namespace UDP {
+
+// Every protocol message is one datagram: a fixed 16-byte header in network
+// byte order followed by the payload.
+//
+//   0        1        2                 4                                 8
+//   +--------+--------+-----------------+---------------------------------+
+//   |version |  type  |  payload length |           session id            |
+//   +--------+--------+-----------------+---------------------------------+
+//   |                          sequence number                            |
+//   +---------------------------------------------------------------------+
+//
+// Integers inside payloads are big endian and fixed width, so a key is two
+// bytes and a timestamp eight, not a decimal string.
+const uint8_t kFrameVersion = 1;
+const size_t kFrameHeaderSize = 16;
+// what is left of the largest UDP payload over IPv4
+const size_t kMaxFramePayload = 65507 - kFrameHeaderSize;
+
+enum class MessageType : uint8_t {
+  kDhPublic = 1,   // Diffie-Hellman public value, as wide as P, in the clear;
+                   // a client adds its name and the name's u8 length, the
+                   // u16 port of its peer and its u8 Role
+  kKeyPrompt = 2,  // KDC's prompt text, under the DH session key
+  kPrivateKey = 3, // the key a client wants to use, u16, under the DH key
+  kSessionKey = 4, // new session key, u16, under the client's private key
+  kTicket = 5,     // the same key for the peer, under the peer's key. Either
+                   // one empty, from the KDC, means the peer never came
+  kTimestamp = 6,  // ms since the epoch, u64, under the peer's key
+  kChat = 7,       // counter-mode ciphertext, sequence is the counter
+  kAck = 8,        // empty reply to the request with the same sequence
+  kResumption = 9, // the reply to kPrivateKey: a u64 resumption ticket and
+                   // its u32 lifetime in seconds, under the DH key
+  kResume = 10     // a returning client's u64 ticket, its u16 private key
+                   // under the ticket's session key, the u16 port of its
+                   // peer and its u8 Role; the reply is u8 1 if resumed
+};
+
+// which end of the Needham-Schroeder exchange a client is: the initiator
+// gets both copies of the session key and passes the responder's on
+enum class Role : uint8_t {
+  kInitiator = 1,
+  kResponder = 2
+};
+// what a client's kDhPublic carries after the value, besides its name
+const size_t kDhRequestTrailer = 1 + 2 + 1;
+const size_t kResumptionSize = 8 + 4;
+const size_t kResumeRequestSize = 8 + 2 + 2 + 1;
+
+struct FrameHeader {
+  uint8_t version;
+  MessageType type;
+  uint16_t length;
+  uint32_t session;
+  uint64_t sequence;
+};
+
+// A parsed frame. payload points into the buffer it was parsed from
+struct Frame {
+  FrameHeader header;
+  const uint8_t* payload;
+  size_t length;
+};
+
+// Parse a received datagram without copying or allocating. Fails on a short
+// datagram, an unknown version or a length that does not match.
+bool parseFrame(const void* data, size_t size, Frame& frame);
+bool parseFrame(const std::string& datagram, Frame& frame);
+
+// Replace out with a frame around payload; out keeps its capacity. length
+// must not exceed kMaxFramePayload
+void buildFrame(std::string& out, MessageType type, uint32_t session, uint64_t sequence,
+                const void* payload, size_t length);
+
+// Receive until a well-formed frame of the given type arrives, dropping
+// anything else. Frames from another session or with a payload of another
+// length are dropped too, unless session is kAnySession or length is
+// kAnyLength. frame points into buffer. Fails only if receiving does.
+const uint32_t kAnySession = 0;
+const size_t kAnyLength = ~static_cast<size_t>(0);
+bool receiveFrame(Server& server, std::string& buffer, MessageType type, uint32_t session,
+                  size_t length, Frame& frame);
+
+// big endian fixed-width fields
+inline void putU16(uint8_t* out, uint16_t value) {
+  out[0] = static_cast<uint8_t>(value >> 8);
+  out[1] = static_cast<uint8_t>(value);
+}
+
+inline void putU32(uint8_t* out, uint32_t value) {
+  putU16(out, static_cast<uint16_t>(value >> 16));
+  putU16(out + 2, static_cast<uint16_t>(value));
+}
+
+inline void putU64(uint8_t* out, uint64_t value) {
+  for (int i = 7; i >= 0; --i, value >>= 8)
+    out[i] = static_cast<uint8_t>(value);
+}
+
+inline uint16_t getU16(const uint8_t* in) {
+  return static_cast<uint16_t>((in[0] << 8) | in[1]);
+}
+
+inline uint32_t getU32(const uint8_t* in) {
+  return (static_cast<uint32_t>(getU16(in)) << 16) | getU16(in + 2);
+}
+
+inline uint64_t getU64(const uint8_t* in) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i)
+    value = (value << 8) | in[i];
+  return value;
+}
+
+} // namespace UDP
+
+#endif // UDP_FRAME_H
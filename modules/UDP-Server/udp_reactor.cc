@@ -0,0 +1,248 @@
+#include "udp_reactor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+
+namespace UDP {
+
+namespace {
+  // events collected per epoll_wait, more are picked up by the next call
+  const int kMaxEvents = 256;
+}
+
+// ----------------------------------------------------------------------------
+Reactor::Reactor() {
+  if ((this->epoll_fd_ = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nepoll_create1() failed" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+Reactor::~Reactor() {
+  // give line readers their blocking descriptors back and close the timers
+  std::vector<int> fds;
+  for (const auto& entry : this->handlers_)
+    fds.push_back(entry.first);
+  for (int fd : fds) {
+    bool owned = this->handlers_[fd]->owned;
+    this->remove(fd);
+    if (owned)
+      close(fd);
+  }
+  close(this->epoll_fd_);
+}
+
+// ----------------------------------------------------------------------------
+Reactor::Handler* Reactor::add(int fd) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof event);
+  event.events = EPOLLIN | EPOLLET;
+  event.data.fd = fd;
+  if (epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nepoll_ctl() failed" << std::endl;
+    return NULL;
+  }
+
+  std::unique_ptr<Handler>& handler = this->handlers_[fd];
+  handler.reset(new Handler());
+  return handler.get();
+}
+
+// ----------------------------------------------------------------------------
+void Reactor::remove(int fd) {
+  std::unordered_map<int, std::unique_ptr<Handler>>::iterator it = this->handlers_.find(fd);
+  if (it == this->handlers_.end())
+    return;
+
+  epoll_ctl(this->epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+  if (it->second->saved_flags >= 0)
+    fcntl(fd, F_SETFL, it->second->saved_flags);
+
+  // the handler may be the one running right now
+  this->retired_.push_back(std::move(it->second));
+  this->handlers_.erase(it);
+}
+
+// ----------------------------------------------------------------------------
+bool Reactor::watch(int fd, Callback on_readable) {
+  Handler* handler = this->add(fd);
+  if (handler == NULL)
+    return false;
+
+  handler->on_readable = std::move(on_readable);
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+void Reactor::unwatch(int fd) {
+  this->remove(fd);
+}
+
+// ----------------------------------------------------------------------------
+bool Reactor::watchLines(int fd, LineCallback on_line, Callback on_eof) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nfcntl() failed" << std::endl;
+    return false;
+  }
+
+  Handler* handler = this->add(fd);
+  if (handler == NULL) {
+    fcntl(fd, F_SETFL, flags);
+    return false;
+  }
+
+  handler->saved_flags = flags;
+  handler->on_readable = [this, fd, on_line, on_eof]() {
+    this->readLines(fd, on_line, on_eof);
+  };
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+void Reactor::readLines(int fd, const LineCallback& on_line, const Callback& on_eof) {
+  Handler* handler = this->handlers_[fd].get();
+  std::string& pending = handler->pending;
+
+  char chunk[4096];
+  while (true) {
+    ssize_t n_bytes = ::read(fd, chunk, sizeof chunk);
+    if (n_bytes > 0) {
+      pending.append(chunk, n_bytes);
+
+      // hand out every complete line
+      size_t start = 0, newline;
+      while ((newline = pending.find('\n', start)) != std::string::npos) {
+        std::string line = pending.substr(start, newline - start);
+        start = newline + 1;
+        on_line(line);
+        // the callback may have stopped watching us
+        if (this->handlers_.count(fd) == 0)
+          return;
+      }
+      pending.erase(0, start);
+      continue;
+    }
+
+    if (n_bytes < 0 && errno == EINTR)
+      continue;
+    if (n_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+
+    // end of input (or a read error): flush a last unterminated line
+    if (n_bytes < 0)
+      std::cerr << "ERROR: " << strerror(errno) << "\nread() failed" << std::endl;
+    if (!pending.empty()) {
+      std::string line;
+      line.swap(pending);
+      on_line(line);
+    }
+    this->remove(fd);
+    on_eof();
+    return;
+  }
+}
+
+// ----------------------------------------------------------------------------
+int Reactor::addTimer(std::chrono::milliseconds interval, Callback on_expiry, bool repeat) {
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\ntimerfd_create() failed" << std::endl;
+    return -1;
+  }
+
+  Handler* handler = this->add(timer);
+  if (handler == NULL) {
+    close(timer);
+    return -1;
+  }
+
+  handler->owned = true;
+  handler->interval = interval;
+  handler->repeat = repeat;
+  handler->on_readable = [this, timer, on_expiry]() {
+    // consume the expiration count so the next one raises a new edge
+    uint64_t expirations;
+    if (::read(timer, &expirations, sizeof expirations) != sizeof expirations)
+      return;
+    if (!this->handlers_[timer]->repeat)
+      this->cancelTimer(timer);
+    on_expiry();
+  };
+  this->armTimer(timer, *handler);
+  return timer;
+}
+
+// ----------------------------------------------------------------------------
+void Reactor::armTimer(int timer, const Handler& handler) {
+  long long ms = handler.interval.count();
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof spec);
+  spec.it_value.tv_sec = ms / 1000;
+  spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+  // a zero it_value would disarm the timer instead of firing at once
+  if (ms <= 0)
+    spec.it_value.tv_nsec = 1;
+  if (handler.repeat)
+    spec.it_interval = spec.it_value;
+
+  if (timerfd_settime(timer, 0, &spec, NULL) < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\ntimerfd_settime() failed" << std::endl;
+  }
+}
+
+// ----------------------------------------------------------------------------
+void Reactor::resetTimer(int timer) {
+  std::unordered_map<int, std::unique_ptr<Handler>>::iterator it = this->handlers_.find(timer);
+  if (it != this->handlers_.end())
+    this->armTimer(timer, *it->second);
+}
+
+// ----------------------------------------------------------------------------
+void Reactor::cancelTimer(int timer) {
+  if (this->handlers_.count(timer) == 0)
+    return;
+  this->remove(timer);
+  close(timer);
+}
+
+// ----------------------------------------------------------------------------
+int Reactor::runOnce(int timeout_ms) {
+  struct epoll_event events[kMaxEvents];
+  int ready = epoll_wait(this->epoll_fd_, events, kMaxEvents, timeout_ms);
+  if (ready < 0) {
+    if (errno == EINTR)
+      return 0;
+    std::cerr << "ERROR: " << strerror(errno) << "\nepoll_wait() failed" << std::endl;
+    return -1;
+  }
+
+  for (int i = 0; i < ready; ++i) {
+    // an earlier callback of this wakeup may have removed the descriptor
+    std::unordered_map<int, std::unique_ptr<Handler>>::iterator it =
+        this->handlers_.find(events[i].data.fd);
+    if (it != this->handlers_.end())
+      it->second->on_readable();
+  }
+  this->retired_.clear();
+  return ready;
+}
+
+// ----------------------------------------------------------------------------
+void Reactor::run() {
+  this->running_ = true;
+  while (this->running_ && !this->handlers_.empty()) {
+    if (this->runOnce() < 0)
+      break;
+  }
+}
+
+} // namespace UDP
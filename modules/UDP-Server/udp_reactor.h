@@ -0,0 +1,85 @@
+#ifndef UDP_REACTOR_H
+#define UDP_REACTOR_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace UDP {
+
+// Single-threaded event loop on edge-triggered epoll. Descriptors are
+// registered with a callback that runs when they become readable; timers
+// are timerfds on the same epoll set. Every event of a wakeup is handled
+// before waiting again, so one loop serves any number of sockets.
+//
+// Edge-triggered means a callback is told once per batch of arrivals: it
+// must read until the descriptor reports EAGAIN, so watched descriptors
+// have to be non-blocking (see Server::setBlocking).
+class Reactor {
+ public:
+  typedef std::function<void()> Callback;
+  typedef std::function<void(std::string& line)> LineCallback;
+
+  Reactor();
+  ~Reactor();
+
+  // copying and moving not allowed
+  Reactor(const Reactor& rhs) = delete;
+  Reactor(Reactor&& rhs) = delete;
+  Reactor& operator=(const Reactor& rhs) = delete;
+  Reactor& operator=(Reactor&& rhs) = delete;
+
+  // Call on_readable whenever fd has new data. Returns false on failure.
+  bool watch(int fd, Callback on_readable);
+  void unwatch(int fd);
+
+  // Read fd (usually STDIN_FILENO) a line at a time, without the newline.
+  // The descriptor is made non-blocking until it is unwatched. on_eof runs
+  // once when the input is closed, after which fd is no longer watched.
+  bool watchLines(int fd, LineCallback on_line, Callback on_eof);
+
+  // Run on_expiry after interval, and every interval after that if repeat
+  // is set. Returns a timer id, or -1 on failure.
+  int addTimer(std::chrono::milliseconds interval, Callback on_expiry, bool repeat = true);
+  // start the countdown over, e.g. for an inactivity timeout
+  void resetTimer(int timer);
+  void cancelTimer(int timer);
+
+  // Wait up to timeout_ms (-1 forever) and dispatch everything that is
+  // ready. Returns the number of events handled, or -1 on error.
+  int runOnce(int timeout_ms = -1);
+  // dispatch until stop() is called, typically from a callback
+  void run();
+  void stop() { running_ = false; }
+
+ private:
+  struct Handler {
+    Callback on_readable;
+    // the reactor created the descriptor and closes it
+    bool owned = false;
+    // timers only
+    std::chrono::milliseconds interval;
+    bool repeat = false;
+    // line readers only
+    int saved_flags = -1;
+    std::string pending;
+  };
+
+  Handler* add(int fd);
+  void remove(int fd);
+  void armTimer(int timer, const Handler& handler);
+  void readLines(int fd, const LineCallback& on_line, const Callback& on_eof);
+
+  int epoll_fd_;
+  bool running_ = false;
+  std::unordered_map<int, std::unique_ptr<Handler>> handlers_;
+  // removed while dispatching; kept alive until the wakeup is done
+  std::vector<std::unique_ptr<Handler>> retired_;
+};
+
+} // namespace UDP
+
+#endif // UDP_REACTOR_H
@@ -1,15 +1,54 @@
 #include "udp_server.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <netinet/udp.h>
 #include <string.h>
 
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include "udp_uring.h"
 
 namespace UDP {
-  const int kMaxBuffer = 1024;
+  const int kMaxBuffer = 65536;
+
+namespace {
+  // resolved peers, keyed by host and port. std::map never moves its nodes,
+  // so handing out references is fine
+  std::mutex endpoints_lock;
+  std::map<std::pair<std::string, int>, Endpoint> endpoints;
+
+  // room for the control messages of one receive: the drop count and the
+  // GRO segment size
+  const size_t kControlSpace = CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(int));
+
+  // ask for a buffer size, forcing it past the sysctl cap where allowed
+  void set_buffer(int sd, int option, int force, int size, const char* sysctl) {
+    int granted = 0;
+    socklen_t len = sizeof granted;
+    if (setsockopt(sd, SOL_SOCKET, option, &size, sizeof size) < 0) {
+      std::cerr << "ERROR: " << strerror(errno) << "\nsetsockopt() failed" << std::endl;
+      return;
+    }
+    getsockopt(sd, SOL_SOCKET, option, &granted, &len);
+    if (granted / 2 < size && setsockopt(sd, SOL_SOCKET, force, &size, sizeof size) < 0) {
+      std::cerr << "WARNING: socket buffer capped at " << granted / 2 << " bytes by "
+                << sysctl << std::endl;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+Server::Server(const std::string& host, int port) : Server(host, port, ServerOptions()) {
+}
 
 // ----------------------------------------------------------------------------
-Server::Server(const std::string& host, int port) : host_(host), port_(port) {
+Server::Server(const std::string& host, int port, const ServerOptions& options)
+    : host_(host), port_(port) {
     
   // create the socket
   if ( (this->sd_ = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) {
@@ -17,6 +56,49 @@ Server::Server(const std::string& host, int port) : host_(host), port_(port) {
       std::exit(EXIT_FAILURE);
   }
 
+  int enable = 1;
+  if (options.reuse_port &&
+      setsockopt(this->sd_, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof enable) < 0) {
+      std::cerr << "ERROR: " << strerror(errno) << "\nsetsockopt() failed" << std::endl;
+      std::exit(EXIT_FAILURE);
+  }
+
+  if (options.receive_buffer > 0) {
+    set_buffer(this->sd_, SO_RCVBUF, SO_RCVBUFFORCE, options.receive_buffer,
+               "net.core.rmem_max");
+  }
+  if (options.send_buffer > 0) {
+    set_buffer(this->sd_, SO_SNDBUF, SO_SNDBUFFORCE, options.send_buffer,
+               "net.core.wmem_max");
+  }
+
+  int segment_size = options.segment_size;
+  if (segment_size > 0 &&
+      setsockopt(this->sd_, SOL_UDP, UDP_SEGMENT, &segment_size, sizeof segment_size) < 0) {
+      std::cerr << "ERROR: " << strerror(errno) << "\nsetsockopt() failed" << std::endl;
+  }
+
+  // the control messages are read by the socket calls only
+  bool sockets = options.backend == Backend::kSockets;
+  if (!sockets && (options.gro || options.count_drops)) {
+    std::cerr << "WARNING: GRO and drop counters need the sockets backend, ignored"
+              << std::endl;
+  }
+  if (sockets && options.gro) {
+    if (setsockopt(this->sd_, SOL_UDP, UDP_GRO, &enable, sizeof enable) < 0) {
+      std::cerr << "ERROR: " << strerror(errno) << "\nsetsockopt() failed" << std::endl;
+    } else {
+      this->gro_ = true;
+      this->coalesced_.resize(kMaxBuffer);
+    }
+  }
+  if (sockets && options.count_drops) {
+    if (setsockopt(this->sd_, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof enable) < 0)
+      std::cerr << "ERROR: " << strerror(errno) << "\nsetsockopt() failed" << std::endl;
+    else
+      this->count_drops_ = true;
+  }
+
   this->sock_.sin_family = AF_INET; // IPv4
   this->sock_.sin_addr.s_addr = htonl(INADDR_ANY);  // accept any address
 
@@ -28,49 +110,410 @@ Server::Server(const std::string& host, int port) : host_(host), port_(port) {
       std::cerr << "ERROR: " << strerror(errno) << "\nbind() failed" << std::endl;
       std::exit(EXIT_FAILURE);
   }
+
+  if (options.backend == Backend::kIoUring) {
+    this->ring_.reset(Ring::create(this->sd_));
+    if (!this->ring_)
+      std::cerr << "WARNING: io_uring unavailable, using plain sockets" << std::endl;
+  }
 }
 
 // ----------------------------------------------------------------------------
-void Server::receive(std::string& return_buffer) {
-  int n_bytes;
-  char buffer[kMaxBuffer];
-  struct sockaddr_in client;
-  int len = sizeof client;
-    
-  // recvfrom is a blocking call
-  n_bytes = recvfrom(this->sd_, buffer, kMaxBuffer, 0, (struct sockaddr* )&client, (socklen_t* )&len);
+Server::~Server() {
+  // the ring goes first, it may still have requests on the socket
+  this->ring_.reset();
+  close(this->sd_);
+}
+
+// ----------------------------------------------------------------------------
+int Server::receiveBufferSize() const {
+  int size = 0;
+  socklen_t len = sizeof size;
+  getsockopt(this->sd_, SOL_SOCKET, SO_RCVBUF, &size, &len);
+  return size;
+}
+
+// ----------------------------------------------------------------------------
+int Server::sendBufferSize() const {
+  int size = 0;
+  socklen_t len = sizeof size;
+  getsockopt(this->sd_, SOL_SOCKET, SO_SNDBUF, &size, &len);
+  return size;
+}
+
+// ----------------------------------------------------------------------------
+void Server::setBlocking(bool blocking) {
+  int flags = fcntl(this->sd_, F_GETFL, 0);
+  flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+  if (fcntl(this->sd_, F_SETFL, flags) < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nfcntl() failed" << std::endl;
+  }
+  this->blocking_ = blocking;
+}
+
+// ----------------------------------------------------------------------------
+bool Server::receive(std::string& return_buffer) {
+  // land in the reusable scratch area, then copy exactly what arrived:
+  // ciphertext may well contain zero bytes
+  if (this->scratch_.size() < (size_t)kMaxBuffer)
+    this->scratch_.resize(kMaxBuffer);
+
+  Buffer buffer;
+  buffer.data = this->scratch_.data();
+  buffer.capacity = kMaxBuffer;
+  if (this->receive(buffer) < 0)
+    return false;
+
+  return_buffer.assign(reinterpret_cast<char*>(buffer.data), buffer.length);
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+ssize_t Server::receive(Buffer& buffer) {
+  if (this->ring_)
+    return this->ring_->receive(buffer, this->blocking_);
+  if (this->gro_)
+    return this->receiveSegment(buffer, 0);
+  if (this->count_drops_)
+    return this->receiveMessage(buffer, 0, NULL);
+
+  socklen_t len = sizeof buffer.address;
+
+  // recvfrom is a blocking call. MSG_TRUNC makes it report the real length
+  // of a datagram that did not fit
+  ssize_t n_bytes = recvfrom(this->sd_, buffer.data, buffer.capacity, MSG_TRUNC,
+                             (struct sockaddr* )&buffer.address, &len);
+  if (n_bytes < 0) {
+    // a non-blocking socket that has been drained is not an error
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      std::cerr << "ERROR: " << strerror(errno) << "\nrecvfrom() failed" << std::endl;
+    buffer.length = 0;
+    return -1;
+  }
+
+  if ((size_t)n_bytes > buffer.capacity) {
+    std::cerr << "ERROR: datagram of " << n_bytes << " bytes truncated to "
+              << buffer.capacity << std::endl;
+    buffer.length = buffer.capacity;
+  } else {
+    buffer.length = n_bytes;
+  }
+  return n_bytes;
+}
+
+// ----------------------------------------------------------------------------
+ssize_t Server::receiveMessage(Buffer& buffer, int flags, size_t* segment) {
+  if (this->control_.size() < kControlSpace)
+    this->control_.resize(kControlSpace);
+
+  struct iovec vector;
+  vector.iov_base = buffer.data;
+  vector.iov_len = buffer.capacity;
+
+  struct msghdr header;
+  memset(&header, 0, sizeof header);
+  header.msg_name = &buffer.address;
+  header.msg_namelen = sizeof buffer.address;
+  header.msg_iov = &vector;
+  header.msg_iovlen = 1;
+  header.msg_control = this->control_.data();
+  header.msg_controllen = kControlSpace;
+
+  ssize_t n_bytes = recvmsg(this->sd_, &header, flags | MSG_TRUNC);
   if (n_bytes < 0) {
-    std::cerr << "ERROR: " << strerror(errno) << "\nrecvfrom() failed" << std::endl;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      std::cerr << "ERROR: " << strerror(errno) << "\nrecvmsg() failed" << std::endl;
+    buffer.length = 0;
+    return -1;
+  }
+  this->readControl(header, segment);
+
+  if ((size_t)n_bytes > buffer.capacity) {
+    std::cerr << "ERROR: datagram of " << n_bytes << " bytes truncated to "
+              << buffer.capacity << std::endl;
+    buffer.length = buffer.capacity;
   } else {
-    // std::cout << "Received datagram from: " << inet_ntoa(client.sin_addr) << "\n";
-   
-    // null terminate and copy it to the return string
-    buffer[n_bytes] = '\0';
-    return_buffer = buffer;
+    buffer.length = n_bytes;
+  }
+  return n_bytes;
+}
+
+// ----------------------------------------------------------------------------
+void Server::readControl(const struct msghdr& header, size_t* segment) {
+  if (segment != NULL)
+    *segment = 0;
+  for (struct cmsghdr* message = CMSG_FIRSTHDR(&header); message != NULL;
+       message = CMSG_NXTHDR(const_cast<struct msghdr*>(&header), message)) {
+    if (message->cmsg_level == SOL_SOCKET && message->cmsg_type == SO_RXQ_OVFL) {
+      // cumulative, and only sent once something has been dropped
+      memcpy(&this->drops_, CMSG_DATA(message), sizeof this->drops_);
+    } else if (message->cmsg_level == SOL_UDP && message->cmsg_type == UDP_GRO &&
+               segment != NULL) {
+      int size;
+      memcpy(&size, CMSG_DATA(message), sizeof size);
+      *segment = size;
+    }
   }
 }
 
+// ----------------------------------------------------------------------------
+ssize_t Server::receiveSegment(Buffer& buffer, int flags) {
+  if (this->coalesced_offset_ >= this->coalesced_length_) {
+    // nothing left over, receive the next (maybe coalesced) datagram
+    Buffer landing;
+    landing.data = this->coalesced_.data();
+    landing.capacity = this->coalesced_.size();
+    size_t segment;
+    if (this->receiveMessage(landing, flags, &segment) < 0) {
+      buffer.length = 0;
+      return -1;
+    }
+
+    this->coalesced_address_ = landing.address;
+    this->coalesced_length_ = landing.length;
+    this->coalesced_offset_ = 0;
+    this->segment_length_ = segment > 0 ? segment : landing.length;
+    if (landing.length == 0) {
+      buffer.length = 0;
+      buffer.address = landing.address;
+      return 0;
+    }
+  }
+
+  // every segment is segment_length_ bytes but the last, which may be short
+  size_t length = std::min(this->segment_length_,
+                           this->coalesced_length_ - this->coalesced_offset_);
+  buffer.length = std::min(length, buffer.capacity);
+  buffer.address = this->coalesced_address_;
+  memcpy(buffer.data, this->coalesced_.data() + this->coalesced_offset_, buffer.length);
+  this->coalesced_offset_ += length;
+
+  if (length > buffer.capacity) {
+    std::cerr << "ERROR: datagram of " << length << " bytes truncated to "
+              << buffer.capacity << std::endl;
+  }
+  return length;
+}
+
 // ----------------------------------------------------------------------------
 void Server::send(const std::string& server_ip, int server_port, const std::string& buffer) {
-  struct sockaddr_in server;
-  struct hostent * hp;
-  server.sin_family = AF_INET;
+  this->send(endpoint(server_ip, server_port), buffer);
+}
+
+// ----------------------------------------------------------------------------
+void Server::send(const Endpoint& destination, const std::string& buffer) {
+  this->send(destination.address, buffer.data(), buffer.size());
+}
+
+// ----------------------------------------------------------------------------
+void Server::send(const std::string& buffer) {
+  this->send(buffer.data(), buffer.size());
+}
+
+// ----------------------------------------------------------------------------
+void Server::send(const void* data, size_t length) {
+  if (this->ring_) {
+    this->ring_->send(NULL, data, length);
+    return;
+  }
+
+  int n_sent = ::send(this->sd_, data, length, 0);
+  if (n_sent < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nsend() failed" << std::endl;
+  }
+}
+
+// ----------------------------------------------------------------------------
+void Server::connect(const Endpoint& peer) {
+  if (::connect(this->sd_, (const struct sockaddr* )&peer.address, sizeof peer.address) < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nconnect() failed" << std::endl;
+    return;
+  }
+  this->connected_ = true;
+}
+
+// ----------------------------------------------------------------------------
+void Server::disconnect() {
+  // connecting to AF_UNSPEC dissolves the association
+  struct sockaddr unspec;
+  memset(&unspec, 0, sizeof unspec);
+  unspec.sa_family = AF_UNSPEC;
+  if (::connect(this->sd_, &unspec, sizeof unspec) < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nconnect() failed" << std::endl;
+  }
+  this->connected_ = false;
+}
+
+// ----------------------------------------------------------------------------
+const Endpoint& Server::endpoint(const std::string& ip, int port) {
+  std::lock_guard<std::mutex> guard(endpoints_lock);
+  std::pair<std::string, int> key(ip, port);
+  std::map<std::pair<std::string, int>, Endpoint>::iterator it = endpoints.find(key);
+  if (it != endpoints.end())
+    return it->second;
+
+  // handed out when resolution fails, sending to it fails loudly instead of
+  // going somewhere unexpected
+  static Endpoint unresolved;
+  unresolved.address.sin_family = AF_UNSPEC;
 
-  if ((hp = gethostbyname(server_ip.c_str())) == NULL) {
-    std::cerr << "ERROR: " << strerror(errno) << "\ngethostbyname() failed" << std::endl;
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  struct addrinfo* result;
+  int status = getaddrinfo(ip.c_str(), NULL, &hints, &result);
+  if (status != 0) {
+    std::cerr << "ERROR: " << gai_strerror(status) << "\ngetaddrinfo() failed" << std::endl;
+    return unresolved;
   }
 
-  memcpy(&server.sin_addr.s_addr, hp->h_addr, hp->h_length);
+  Endpoint resolved;
+  memcpy(&resolved.address, result->ai_addr, sizeof resolved.address);
+  freeaddrinfo(result);
 
   // establish the server port number - we must use network byte order!
-  server.sin_port = htons(server_port);
+  resolved.address.sin_port = htons(port);
+  return endpoints.insert(std::make_pair(key, resolved)).first->second;
+}
 
-  // send it to the echo server
-  int n_sent = sendto(this->sd_, buffer.c_str(), buffer.size(), 0, (struct sockaddr* )&server, sizeof server);
+// ----------------------------------------------------------------------------
+void Server::send(const struct sockaddr_in& destination, const void* data, size_t length) {
+  if (this->ring_) {
+    this->ring_->send(&destination, data, length);
+    return;
+  }
 
+  int n_sent = sendto(this->sd_, data, length, 0, (struct sockaddr* )&destination,
+                      sizeof destination);
   if (n_sent < 0) {
     std::cerr << "ERROR: " << strerror(errno) << "\nsendto() failed" << std::endl;
   }
 }
 
+// ----------------------------------------------------------------------------
+int Server::receiveBatch(Buffer* buffers, size_t count) {
+  if (count == 0)
+    return 0;
+  if (this->ring_)
+    return this->ring_->receiveBatch(buffers, count, this->blocking_);
+
+  if (this->gro_) {
+    // one coalesced receive fills many buffers: split it, then go back to
+    // the socket for more, but only wait for the first
+    size_t received = 0;
+    while (received < count &&
+           this->receiveSegment(buffers[received], received == 0 ? 0 : MSG_DONTWAIT) >= 0)
+      ++received;
+    return received > 0 ? static_cast<int>(received) : -1;
+  }
+
+  if (this->count_drops_ && this->control_.size() < count * kControlSpace)
+    this->control_.resize(count * kControlSpace);
+
+  this->headers_.resize(count);
+  this->vectors_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    // receive straight into each buffer
+    this->vectors_[i].iov_base = buffers[i].data;
+    this->vectors_[i].iov_len = buffers[i].capacity;
+
+    struct msghdr& header = this->headers_[i].msg_hdr;
+    memset(&header, 0, sizeof header);
+    header.msg_name = &buffers[i].address;
+    header.msg_namelen = sizeof buffers[i].address;
+    header.msg_iov = &this->vectors_[i];
+    header.msg_iovlen = 1;
+    if (this->count_drops_) {
+      header.msg_control = this->control_.data() + i * kControlSpace;
+      header.msg_controllen = kControlSpace;
+    }
+  }
+
+  // block for the first datagram only, then drain what is already queued
+  int received = recvmmsg(this->sd_, this->headers_.data(), count, MSG_WAITFORONE, NULL);
+  if (received < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      std::cerr << "ERROR: " << strerror(errno) << "\nrecvmmsg() failed" << std::endl;
+    return -1;
+  }
+
+  for (int i = 0; i < received; ++i) {
+    if (this->count_drops_)
+      this->readControl(this->headers_[i].msg_hdr, NULL);
+    buffers[i].length = this->headers_[i].msg_len;
+    if (this->headers_[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      std::cerr << "ERROR: datagram truncated to " << buffers[i].capacity
+                << " bytes" << std::endl;
+    }
+  }
+  return received;
+}
+
+// ----------------------------------------------------------------------------
+int Server::receiveBatch(std::vector<Datagram>& batch) {
+  size_t count = batch.size();
+  if (this->scratch_.size() < count * kMaxBuffer)
+    this->scratch_.resize(count * kMaxBuffer);
+  this->scratch_buffers_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    this->scratch_buffers_[i].data = this->scratch_.data() + i * kMaxBuffer;
+    this->scratch_buffers_[i].capacity = kMaxBuffer;
+  }
+
+  int received = this->receiveBatch(this->scratch_buffers_.data(), count);
+  for (int i = 0; i < received; ++i) {
+    const Buffer& buffer = this->scratch_buffers_[i];
+    batch[i].payload.assign(reinterpret_cast<char*>(buffer.data), buffer.length);
+    batch[i].address = buffer.address;
+  }
+  return received;
+}
+
+// ----------------------------------------------------------------------------
+int Server::sendBatch(const std::vector<Datagram>& batch, size_t count) {
+  if (count > batch.size())
+    count = batch.size();
+
+  if (this->ring_) {
+    // queue them all, then one submission
+    size_t queued = 0;
+    while (queued < count && this->ring_->queue(&batch[queued].address,
+                                                batch[queued].payload.data(),
+                                                batch[queued].payload.size()))
+      ++queued;
+    if (!this->ring_->submit())
+      return -1;
+    return static_cast<int>(queued);
+  }
+
+  this->headers_.resize(count);
+  this->vectors_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    const std::string& payload = batch[i].payload;
+    this->vectors_[i].iov_base = const_cast<char*>(payload.data());
+    this->vectors_[i].iov_len = payload.size();
+
+    struct msghdr& header = this->headers_[i].msg_hdr;
+    memset(&header, 0, sizeof header);
+    header.msg_name = const_cast<struct sockaddr_in*>(&batch[i].address);
+    header.msg_namelen = sizeof batch[i].address;
+    header.msg_iov = &this->vectors_[i];
+    header.msg_iovlen = 1;
+  }
+
+  // sendmmsg may stop early, so keep going until everything is out
+  size_t sent = 0;
+  while (sent < count) {
+    int n_sent = sendmmsg(this->sd_, this->headers_.data() + sent, count - sent, 0);
+    if (n_sent < 0) {
+      std::cerr << "ERROR: " << strerror(errno) << "\nsendmmsg() failed" << std::endl;
+      return sent > 0 ? static_cast<int>(sent) : -1;
+    }
+    sent += n_sent;
+  }
+  return static_cast<int>(sent);
+}
+
 } // namespace UDP
\ No newline at end of file
@@ -8,17 +8,74 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "udp_buffer.h"
 
 namespace UDP {
+  // largest datagram we can receive (IPv4 payloads top out at 65507 bytes)
   extern const int kMaxBuffer;
 
+// A resolved peer. Get one from Server::endpoint() once and reuse it for
+// every send to that peer.
+struct Endpoint {
+  struct sockaddr_in address;
+};
+
+// One datagram in a batch. The address is the sender for receiveBatch and
+// the destination for sendBatch.
+struct Datagram {
+  std::string payload;
+  struct sockaddr_in address;
+};
+
+// How a Server moves its datagrams. kIoUring falls back to kSockets, with
+// a warning, where io_uring is not available.
+enum class Backend {
+  kSockets,  // recvfrom/sendto and recvmmsg/sendmmsg
+  kIoUring   // multishot recvmsg into provided buffers, see udp_uring.h
+};
+
+// Socket settings applied before bind
+struct ServerOptions {
+  // share the port with other sockets that set it too; the kernel spreads
+  // incoming datagrams over them by hashing the sender's address and port
+  bool reuse_port = false;
+  Backend backend = Backend::kSockets;
+
+  // SO_RCVBUF / SO_SNDBUF in bytes, 0 keeps the kernel default. The kernel
+  // doubles what it is given and caps it at net.core.rmem_max / wmem_max,
+  // unless the process has CAP_NET_ADMIN
+  int receive_buffer = 0;
+  int send_buffer = 0;
+
+  // UDP_SEGMENT (GSO): a send longer than this leaves as one super-datagram
+  // of up to 64 KB that the kernel, or the NIC, cuts into datagrams of
+  // segment_size bytes. 0 sends every datagram as it is
+  uint16_t segment_size = 0;
+
+  // UDP_GRO: let the kernel hand up runs of same-sized datagrams from one
+  // sender as one buffer. The receive calls split them again, so callers
+  // still see one datagram at a time; each is copied once out of the
+  // coalesced buffer. Sockets backend only
+  bool gro = false;
+
+  // SO_RXQ_OVFL: keep count of datagrams the kernel dropped because the
+  // receive queue was full, see drops(). Sockets backend only
+  bool count_drops = false;
+};
+
+class Ring;
+
 class Server {
  public:
 
   // Constructor
   Server(const std::string& host, int port);
-  ~Server() = default;
+  Server(const std::string& host, int port, const ServerOptions& options);
+  ~Server();
 
   // copying and moving not allowed
   Server(const Server& rhs) = delete;
@@ -28,11 +85,64 @@ class Server {
 
   // Accessors
   int getSocketDescriptor() const { return sd_; }
+  Backend backend() const { return ring_ ? Backend::kIoUring : Backend::kSockets; }
+
+  // The buffer sizes the kernel actually granted, as getsockopt reports
+  // them (twice what was asked for, when it was not capped)
+  int receiveBufferSize() const;
+  int sendBufferSize() const;
+
+  // Datagrams dropped on this socket's full receive queue since it was
+  // created, as of the last receive. Stays 0 unless options.count_drops
+  uint32_t drops() const { return drops_; }
+
+  // A non-blocking server fails its receives instead of waiting once the
+  // queue is empty (errno is EAGAIN), as an edge-triggered Reactor needs.
+  // With io_uring the kernel takes datagrams off the socket by itself, so
+  // socket readiness means nothing there: poll with non-blocking receives.
+  void setBlocking(bool blocking);
 
 
-  // member functions
-  void receive(std::string& return_buffer);
+  // member functions, receive returns false if nothing could be received
+  bool receive(std::string& return_buffer);
   void send(const std::string& server_ip, int server_port, const std::string& buffer);
+  void send(const Endpoint& destination, const std::string& buffer);
+
+  // Connected mode: after connect() the socket only talks to that peer, so
+  // send() needs no address and the kernel skips the per-call route lookup.
+  // Datagrams from anybody else are no longer received until disconnect().
+  void connect(const Endpoint& peer);
+  void disconnect();
+  bool isConnected() const { return connected_; }
+  void send(const std::string& buffer);
+  void send(const void* data, size_t length);
+
+  // Zero-copy receive into caller-owned or pooled memory. Returns the full
+  // datagram length (more than buffer.capacity if it had to be truncated),
+  // or -1 on error. Datagrams may be up to kMaxBuffer bytes.
+  ssize_t receive(Buffer& buffer);
+  void send(const struct sockaddr_in& destination, const void* data, size_t length);
+
+  // Move many datagrams per system call (recvmmsg/sendmmsg). receiveBatch
+  // waits (unless non-blocking) until at least one datagram arrives, then
+  // takes whatever else is already queued, up to the batch size. Both
+  // return how many datagrams were moved, or -1 on error. The Buffer form
+  // receives in place; the Datagram form copies each datagram once into its
+  // payload string, which keeps its capacity between calls.
+  int receiveBatch(Buffer* buffers, size_t count);
+  int receiveBatch(std::vector<Datagram>& batch);
+  int sendBatch(const std::vector<Datagram>& batch, size_t count);
+  int sendBatch(const std::vector<Datagram>& batch) { return sendBatch(batch, batch.size()); }
+
+  // Resolve a peer with getaddrinfo. Results are cached for the life of
+  // the process and shared by all servers, and the reference stays valid.
+  // Safe to call from any thread.
+  static const Endpoint& endpoint(const std::string& ip, int port);
+
+  // Build a destination address for sendBatch
+  static struct sockaddr_in address(const std::string& ip, int port) {
+    return endpoint(ip, port).address;
+  }
 
 
 
@@ -42,6 +152,37 @@ class Server {
   struct sockaddr_in sock_;
   int port_;
   std::string host_;
+  bool connected_ = false;
+  bool blocking_ = true;
+
+  // set for Backend::kIoUring
+  std::unique_ptr<Ring> ring_;
+
+  // control messages (GRO segment size, drop count) are only asked for
+  // when they were enabled
+  bool gro_ = false;
+  bool count_drops_ = false;
+  uint32_t drops_ = 0;
+  std::vector<uint8_t> control_;
+
+  // the last coalesced GRO receive, handed out one segment at a time
+  std::vector<uint8_t> coalesced_;
+  size_t coalesced_length_ = 0;
+  size_t coalesced_offset_ = 0;
+  size_t segment_length_ = 0;
+  struct sockaddr_in coalesced_address_;
+
+  ssize_t receiveMessage(Buffer& buffer, int flags, size_t* segment);
+  ssize_t receiveSegment(Buffer& buffer, int flags);
+  void readControl(const struct msghdr& header, size_t* segment);
+
+  // scratch space for the batch calls, reused between calls
+  std::vector<struct mmsghdr> headers_;
+  std::vector<struct iovec> vectors_;
+
+  // landing area for the std::string receives, kMaxBuffer per datagram
+  std::vector<uint8_t> scratch_;
+  std::vector<Buffer> scratch_buffers_;
 
 
 
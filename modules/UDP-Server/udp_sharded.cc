@@ -0,0 +1,77 @@
+#include "udp_sharded.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include <iostream>
+
+namespace UDP {
+
+// ----------------------------------------------------------------------------
+ShardedServer::ShardedServer(const std::string& host, int port, size_t shards)
+    : stopping_(false) {
+  // the cores we are allowed on, shards are pinned round robin over them
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof allowed, &allowed) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed))
+        this->cpus_.push_back(cpu);
+    }
+  }
+
+  if (shards == 0)
+    shards = this->cpus_.empty() ? 1 : this->cpus_.size();
+
+  ServerOptions options;
+  options.reuse_port = true;
+  for (size_t i = 0; i < shards; ++i)
+    this->shards_.emplace_back(new Server(host, port, options));
+}
+
+// ----------------------------------------------------------------------------
+ShardedServer::~ShardedServer() {
+  this->stop();
+  this->join();
+}
+
+// ----------------------------------------------------------------------------
+void ShardedServer::start(Worker worker) {
+  for (size_t i = 0; i < this->shards_.size(); ++i) {
+    this->threads_.emplace_back(worker, std::ref(*this->shards_[i]), i);
+
+    if (this->cpus_.empty())
+      continue;
+    cpu_set_t cpu;
+    CPU_ZERO(&cpu);
+    CPU_SET(this->cpus_[i % this->cpus_.size()], &cpu);
+    int error = pthread_setaffinity_np(this->threads_.back().native_handle(), sizeof cpu, &cpu);
+    if (error != 0) {
+      std::cerr << "ERROR: " << strerror(error) << "\npthread_setaffinity_np() failed" << std::endl;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+void ShardedServer::stop() {
+  if (this->stopping_.exchange(true))
+    return;
+
+  // a receive blocked on a shut down socket returns at once, and so do all
+  // later ones. The sockets can still send
+  for (size_t i = 0; i < this->shards_.size(); ++i)
+    shutdown(this->shards_[i]->getSocketDescriptor(), SHUT_RD);
+}
+
+// ----------------------------------------------------------------------------
+void ShardedServer::join() {
+  for (size_t i = 0; i < this->threads_.size(); ++i) {
+    if (this->threads_[i].joinable())
+      this->threads_[i].join();
+  }
+  this->threads_.clear();
+}
+
+} // namespace UDP
@@ -0,0 +1,59 @@
+#ifndef UDP_SHARDED_H
+#define UDP_SHARDED_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "udp_server.h"
+
+namespace UDP {
+
+// N sockets bound to the same port with SO_REUSEPORT, each served by its own
+// thread pinned to one core. The kernel picks the socket by hashing the
+// sender's address and port, so every datagram of one client endpoint lands
+// on the same shard and per-client state never has to cross threads (as long
+// as the set of shards does not change).
+class ShardedServer {
+ public:
+  // Runs on the shard's thread until it returns; a worker should return
+  // once stopping() is set. Its receives come back empty after stop().
+  typedef std::function<void(Server& shard, size_t index)> Worker;
+
+  // zero shards means one per core this process may run on
+  ShardedServer(const std::string& host, int port, size_t shards = 0);
+  ~ShardedServer();
+
+  // copying and moving not allowed
+  ShardedServer(const ShardedServer& rhs) = delete;
+  ShardedServer(ShardedServer&& rhs) = delete;
+  ShardedServer& operator=(const ShardedServer& rhs) = delete;
+  ShardedServer& operator=(ShardedServer&& rhs) = delete;
+
+  size_t size() const { return shards_.size(); }
+  Server& shard(size_t index) { return *shards_[index]; }
+
+  // start one pinned thread per shard, each running worker(shard, index)
+  void start(Worker worker);
+  // ask the workers to finish and wake the ones blocked in a receive. The
+  // shards stop receiving for good, a stopped server cannot start again
+  void stop();
+  bool stopping() const { return stopping_.load(std::memory_order_relaxed); }
+  // wait for all workers to return
+  void join();
+
+ private:
+  std::vector<std::unique_ptr<Server>> shards_;
+  std::vector<std::thread> threads_;
+  std::vector<int> cpus_;
+  std::atomic<bool> stopping_;
+};
+
+} // namespace UDP
+
+#endif // UDP_SHARDED_H
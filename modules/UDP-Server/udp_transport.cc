@@ -0,0 +1,380 @@
+#include "udp_transport.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+namespace UDP {
+
+namespace {
+  // how many early frames are held back
+  const size_t kHeldBack = 16;
+
+  // RFC 6298 gains and clock granularity
+  const double kAlpha = 1.0 / 8;
+  const double kBeta = 1.0 / 4;
+  const double kGranularity = 1.0;
+
+  typedef std::chrono::steady_clock Clock;
+
+  // ----------------------------------------------------------------------------
+  bool same_address(const struct sockaddr_in& a, const struct sockaddr_in& b) {
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+  }
+}
+
+// ----------------------------------------------------------------------------
+Transport::Transport(Server& server, const TransportOptions& options)
+    : server_(server), options_(options), scratch_(kMaxBuffer) {
+  this->seen_index_.reserve(options.remembered);
+  // start somewhere random, so that a restarted peer's old frames do not
+  // pass for new ones
+  std::random_device random;
+  this->next_sequence_ = (static_cast<uint64_t>(random()) << 32) | random();
+}
+
+// ----------------------------------------------------------------------------
+uint64_t Transport::keyOf(const struct sockaddr_in& address) {
+  return (static_cast<uint64_t>(ntohl(address.sin_addr.s_addr)) << 16) |
+         ntohs(address.sin_port);
+}
+
+// ----------------------------------------------------------------------------
+Transport::Estimate& Transport::estimate(const struct sockaddr_in& peer) {
+  Estimate& estimate = this->estimates_[keyOf(peer)];
+  if (estimate.rto == 0)
+    estimate.rto = this->options_.initial_rto.count();
+  return estimate;
+}
+
+// ----------------------------------------------------------------------------
+std::chrono::milliseconds Transport::rto(const struct sockaddr_in& peer) {
+  return std::chrono::milliseconds(static_cast<long>(this->estimate(peer).rto));
+}
+
+// ----------------------------------------------------------------------------
+void Transport::sample(Estimate& estimate, double rtt) {
+  if (!estimate.measured) {
+    estimate.srtt = rtt;
+    estimate.rttvar = rtt / 2;
+    estimate.measured = true;
+  } else {
+    estimate.rttvar = (1 - kBeta) * estimate.rttvar + kBeta * std::fabs(estimate.srtt - rtt);
+    estimate.srtt = (1 - kAlpha) * estimate.srtt + kAlpha * rtt;
+  }
+  double rto = estimate.srtt + std::max(kGranularity, 4 * estimate.rttvar);
+  rto = std::max(rto, static_cast<double>(this->options_.min_rto.count()));
+  estimate.rto = std::min(rto, static_cast<double>(this->options_.max_rto.count()));
+}
+
+// ----------------------------------------------------------------------------
+void Transport::backOff(Estimate& estimate) {
+  // the backed off timer stays until a new sample brings it down again
+  estimate.rto = std::min(estimate.rto * 2, static_cast<double>(this->options_.max_rto.count()));
+}
+
+// ----------------------------------------------------------------------------
+void Transport::sample(const struct sockaddr_in& peer,
+                       std::chrono::duration<double, std::milli> rtt) {
+  this->sample(this->estimate(peer), rtt.count());
+}
+
+// ----------------------------------------------------------------------------
+void Transport::backOff(const struct sockaddr_in& peer) {
+  this->backOff(this->estimate(peer));
+}
+
+// ----------------------------------------------------------------------------
+bool Transport::next(int timeout_ms, std::string& buffer, Frame& frame,
+                     struct sockaddr_in& from) {
+  struct pollfd socket;
+  socket.fd = this->server_.getSocketDescriptor();
+  socket.events = POLLIN;
+  int ready = poll(&socket, 1, timeout_ms);
+  if (ready < 0 && errno != EINTR) {
+    std::cerr << "ERROR: " << strerror(errno) << "\npoll() failed" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  if (ready <= 0)
+    return false;
+
+  Buffer landing;
+  landing.data = this->scratch_.data();
+  landing.capacity = this->scratch_.size();
+  if (this->server_.receive(landing) < 0)
+    return false;
+
+  buffer.assign(reinterpret_cast<char*>(landing.data), landing.length);
+  from = landing.address;
+  if (!parseFrame(buffer, frame)) {
+    std::cerr << "ERROR: dropped a malformed frame" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+Transport::SeenKey Transport::keyOf(const FrameHeader& header, const struct sockaddr_in& from) {
+  SeenKey key;
+  key.peer = keyOf(from);
+  key.session = header.session;
+  key.sequence = header.sequence;
+  key.type = header.type;
+  return key;
+}
+
+// ----------------------------------------------------------------------------
+size_t Transport::SeenKeyHash::operator()(const SeenKey& key) const {
+  // sequence numbers are random per sender and count up, so they carry
+  // most of the entropy; mix the rest in and spread it over all the bits
+  uint64_t hash = key.sequence ^ (key.peer * 0x9e3779b97f4a7c15ULL) ^
+                  ((static_cast<uint64_t>(key.session) << 8 |
+                    static_cast<uint8_t>(key.type)) * 0xc2b2ae3d27d4eb4fULL);
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return static_cast<size_t>(hash);
+}
+
+// ----------------------------------------------------------------------------
+Transport::Seen* Transport::seen(const FrameHeader& header, const struct sockaddr_in& from) {
+  std::unordered_map<SeenKey, Seen*, SeenKeyHash>::const_iterator it =
+      this->seen_index_.find(keyOf(header, from));
+  return it == this->seen_index_.end() ? NULL : it->second;
+}
+
+// ----------------------------------------------------------------------------
+void Transport::remember(const FrameHeader& header, const struct sockaddr_in& from) {
+  SeenKey key = keyOf(header, from);
+  if (this->seen_index_.count(key) != 0)
+    return;
+  if (!this->seen_.empty() && this->seen_.size() >= this->options_.remembered) {
+    this->seen_index_.erase(this->seen_.front().key);
+    this->seen_.pop_front();
+  }
+  Seen seen;
+  seen.key = key;
+  this->seen_.push_back(std::move(seen));
+  this->seen_index_.emplace(key, &this->seen_.back());
+}
+
+// ----------------------------------------------------------------------------
+void Transport::holdBack(const std::string& datagram, const Frame& frame,
+                         const struct sockaddr_in& from) {
+  // a retransmission of something already held back adds nothing
+  for (const Early& early : this->early_) {
+    Frame held;
+    if (same_address(early.from, from) && parseFrame(early.datagram, held) &&
+        held.header.type == frame.header.type && held.header.session == frame.header.session &&
+        held.header.sequence == frame.header.sequence)
+      return;
+  }
+  if (this->early_.size() == kHeldBack)
+    this->early_.pop_front();
+  Early early;
+  early.datagram = datagram;
+  early.from = from;
+  this->early_.push_back(std::move(early));
+}
+
+// ----------------------------------------------------------------------------
+bool Transport::answer(const FrameHeader& header, const struct sockaddr_in& from) {
+  Seen* seen = this->seen(header, from);
+  if (seen == NULL)
+    return false;
+  if (!seen->reply.empty())
+    this->server_.send(from, seen->reply.data(), seen->reply.size());
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+bool Transport::admit(const FrameHeader& header, const struct sockaddr_in& from) {
+  if (this->answer(header, from))
+    return false;
+  this->remember(header, from);
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+bool Transport::request(const struct sockaddr_in& peer, MessageType type, uint32_t session,
+                        const void* payload, size_t length, MessageType reply,
+                        std::string& buffer, Frame& frame) {
+  this->frames_.resize(1);
+  buildFrame(this->frames_[0], type, session, this->sequence(), payload, length);
+  return this->exchange(peer, this->frames_, reply, buffer, frame);
+}
+
+// ----------------------------------------------------------------------------
+bool Transport::exchange(const struct sockaddr_in& peer, const std::vector<std::string>& frames,
+                         MessageType reply, std::string& buffer, Frame& frame) {
+  Frame last;
+  if (frames.empty() || !parseFrame(frames.back(), last)) {
+    std::cerr << "ERROR: exchange() needs well-formed frames" << std::endl;
+    return false;
+  }
+
+  this->batch_.resize(frames.size());
+  for (size_t i = 0; i < frames.size(); ++i) {
+    this->batch_[i].payload = frames[i];
+    this->batch_[i].address = peer;
+  }
+
+  Estimate& estimate = this->estimate(peer);
+  Clock::time_point first = Clock::now();
+  struct sockaddr_in from;
+  for (int attempt = 1; attempt <= this->options_.max_attempts; ++attempt) {
+    if (this->batch_.size() == 1)
+      this->server_.send(peer, frames[0].data(), frames[0].size());
+    else
+      this->server_.sendBatch(this->batch_);
+
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(
+        static_cast<long>(std::ceil(estimate.rto)));
+    while (true) {
+      long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - Clock::now()).count();
+      if (remaining <= 0 || !this->next(remaining, buffer, frame, from)) {
+        if (Clock::now() >= deadline)
+          break;
+        continue;
+      }
+
+      if (same_address(from, peer) && frame.header.type == reply &&
+          frame.header.session == last.header.session &&
+          frame.header.sequence == last.header.sequence) {
+        // Karn: a reply to a resent request could belong to either copy
+        if (attempt == 1) {
+          std::chrono::duration<double, std::milli> rtt = Clock::now() - first;
+          this->sample(estimate, rtt.count());
+        }
+        return true;
+      }
+      if (!this->answer(frame.header, from))
+        this->holdBack(buffer, frame, from);
+    }
+    this->backOff(estimate);
+  }
+
+  std::cerr << "ERROR: no reply from " << inet_ntoa(peer.sin_addr) << ":"
+            << ntohs(peer.sin_port) << " after " << this->options_.max_attempts
+            << " attempts" << std::endl;
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+bool Transport::receiveRequest(MessageType type, uint32_t session, std::string& buffer,
+                               Frame& frame, struct sockaddr_in& from,
+                               std::chrono::milliseconds wait) {
+  return this->receiveRequest(NULL, type, session, buffer, frame, from, wait);
+}
+
+// ----------------------------------------------------------------------------
+bool Transport::receiveRequest(const struct sockaddr_in& peer, MessageType type,
+                               uint32_t session, std::string& buffer, Frame& frame,
+                               std::chrono::milliseconds wait) {
+  struct sockaddr_in from;
+  return this->receiveRequest(&peer, type, session, buffer, frame, from, wait);
+}
+
+// ----------------------------------------------------------------------------
+bool Transport::receiveRequest(const struct sockaddr_in* peer, MessageType type,
+                               uint32_t session, std::string& buffer, Frame& frame,
+                               struct sockaddr_in& from, std::chrono::milliseconds wait) {
+  // anything that came in early first, oldest first
+  for (std::deque<Early>::iterator it = this->early_.begin(); it != this->early_.end(); ++it) {
+    Frame held;
+    if (!parseFrame(it->datagram, held) || held.header.type != type ||
+        (session != kAnySession && held.header.session != session) ||
+        (peer != NULL && !same_address(it->from, *peer)))
+      continue;
+    buffer.swap(it->datagram);
+    from = it->from;
+    this->early_.erase(it);
+    parseFrame(buffer, frame);
+    this->remember(frame.header, from);
+    return true;
+  }
+
+  using namespace std::chrono;
+  Clock::time_point deadline = Clock::now() + wait;
+  while (true) {
+    // rounded up, so that the last poll does not spin
+    microseconds left = duration_cast<microseconds>(deadline - Clock::now());
+    if (left.count() <= 0)
+      return false;
+    int timeout_ms = static_cast<int>((left.count() + 999) / 1000);
+    if (!this->next(timeout_ms, buffer, frame, from) || this->answer(frame.header, from))
+      continue;
+
+    if (frame.header.type == type &&
+        (session == kAnySession || frame.header.session == session) &&
+        (peer == NULL || same_address(from, *peer))) {
+      this->remember(frame.header, from);
+      return true;
+    }
+    this->holdBack(buffer, frame, from);
+  }
+}
+
+// ----------------------------------------------------------------------------
+void Transport::reply(const struct sockaddr_in& peer, const FrameHeader& request,
+                      MessageType type, const void* payload, size_t length) {
+  std::string frame;
+  buildFrame(frame, type, request.session, request.sequence, payload, length);
+  this->server_.send(peer, frame.data(), frame.size());
+
+  Seen* seen = this->seen(request, peer);
+  if (seen != NULL)
+    seen->reply.swap(frame);
+}
+
+// ----------------------------------------------------------------------------
+bool Transport::serveUntilReadable(int fd) {
+  struct pollfd fds[2];
+  fds[0].fd = fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = this->server_.getSocketDescriptor();
+  fds[1].events = POLLIN;
+
+  std::string buffer;
+  Frame frame;
+  struct sockaddr_in from;
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "ERROR: " << strerror(errno) << "\npoll() failed" << std::endl;
+      return false;
+    }
+    if (fds[0].revents != 0)
+      return true;
+    if (this->next(0, buffer, frame, from) && !this->answer(frame.header, from))
+      this->holdBack(buffer, frame, from);
+  }
+}
+
+// ----------------------------------------------------------------------------
+void Transport::linger(std::chrono::milliseconds quiet) {
+  std::string buffer;
+  Frame frame;
+  struct sockaddr_in from;
+  Clock::time_point deadline = Clock::now() + quiet;
+  while (true) {
+    long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Clock::now()).count();
+    if (remaining <= 0)
+      return;
+    if (this->next(remaining, buffer, frame, from)) {
+      this->answer(frame.header, from);
+      deadline = Clock::now() + quiet;
+    }
+  }
+}
+
+} // namespace UDP
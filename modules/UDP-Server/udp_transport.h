@@ -0,0 +1,190 @@
+#ifndef UDP_TRANSPORT_H
+#define UDP_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "udp_frame.h"
+#include "udp_server.h"
+
+namespace UDP {
+
+// Retransmission settings. The timer follows RFC 6298, but starts lower and
+// may go lower than its 1 s: these handshakes cross a LAN, not the internet.
+struct TransportOptions {
+  std::chrono::milliseconds initial_rto{200};
+  std::chrono::milliseconds min_rto{20};
+  std::chrono::milliseconds max_rto{5000};
+  // sends of a request before giving up on the peer. With the defaults a
+  // dead peer is declared after about 45 s
+  int max_attempts = 12;
+  // requests remembered for duplicate suppression; a server with many
+  // handshakes in flight wants more
+  size_t remembered = 64;
+};
+
+// Request/response over frames on one Server, so that a lost datagram
+// costs a retransmission instead of a hung handshake.
+//
+// A request is one or more frames; the reply is a frame with the session
+// and sequence number of the last of them. request() and exchange() resend
+// all of them, with exponential backoff, until the reply comes or the peer
+// is given up on. Each peer gets its own round-trip estimate, sampled only
+// from requests that were not resent (Karn's rule).
+//
+// The other side uses receiveRequest() and reply(). Requests it has seen
+// are remembered for a while: a resent one is not handed out again, and
+// gets the same reply again if it was answered, from whichever receive call
+// of this Transport comes across it. Frames that nobody waits for yet are
+// held back for a later receiveRequest().
+//
+// Waits with poll(), so the Server must use the sockets backend.
+class Transport {
+ public:
+  explicit Transport(Server& server, const TransportOptions& options = TransportOptions());
+
+  // copying and moving not allowed
+  Transport(const Transport& rhs) = delete;
+  Transport(Transport&& rhs) = delete;
+  Transport& operator=(const Transport& rhs) = delete;
+  Transport& operator=(Transport&& rhs) = delete;
+
+  const TransportOptions& options() const { return options_; }
+
+  // A fresh sequence number, for frames built by hand for exchange()
+  uint64_t sequence() { return next_sequence_++; }
+
+  // Send a frame and wait for the reply of the given type. frame points
+  // into buffer. false once the peer has not answered max_attempts sends.
+  bool request(const struct sockaddr_in& peer, MessageType type, uint32_t session,
+               const void* payload, size_t length, MessageType reply,
+               std::string& buffer, Frame& frame);
+
+  // The same for frames that were already built, or received and are
+  // being passed on as they are. They leave together, in one batch.
+  bool exchange(const struct sockaddr_in& peer, const std::vector<std::string>& frames,
+                MessageType reply, std::string& buffer, Frame& frame);
+
+  // Wait up to wait for a new request of the given type, from any session
+  // if session is kAnySession. frame points into buffer. false if none came
+  bool receiveRequest(MessageType type, uint32_t session, std::string& buffer, Frame& frame,
+                      struct sockaddr_in& from, std::chrono::milliseconds wait);
+  // the same, but only from peer; other requests wait their turn
+  bool receiveRequest(const struct sockaddr_in& peer, MessageType type, uint32_t session,
+                      std::string& buffer, Frame& frame, std::chrono::milliseconds wait);
+
+  // How long a requester keeps resending before it gives up, at most: the
+  // wait for a request the peer is sending already
+  std::chrono::milliseconds patience() const {
+    return options_.max_attempts * options_.max_rto;
+  }
+
+  // Answer a request. The reply is kept to answer retransmissions with.
+  void reply(const struct sockaddr_in& peer, const FrameHeader& request, MessageType type,
+             const void* payload, size_t length);
+  void acknowledge(const struct sockaddr_in& peer, const FrameHeader& request) {
+    reply(peer, request, MessageType::kAck, NULL, 0);
+  }
+
+  // For code that receives on the Server itself: true if the frame is a
+  // request seen before, answered again if it had been answered
+  bool answer(const FrameHeader& header, const struct sockaddr_in& from);
+  // the same, but a new request is remembered, so that reply() keeps the
+  // answer to it. true if the request is new
+  bool admit(const FrameHeader& header, const struct sockaddr_in& from);
+
+  // For event loops that keep their own requests outstanding rather than
+  // block in request(): the reply to a request sent once took rtt, or a
+  // request timed out and is about to be resent
+  void sample(const struct sockaddr_in& peer, std::chrono::duration<double, std::milli> rtt);
+  void backOff(const struct sockaddr_in& peer);
+
+  // Keep answering retransmissions while waiting for fd to become readable,
+  // say stdin while somebody types. false on error.
+  bool serveUntilReadable(int fd);
+
+  // Keep answering retransmissions until nothing has arrived for quiet,
+  // before going away: the last reply may have been lost
+  void linger(std::chrono::milliseconds quiet);
+
+  // the current retransmission timeout towards peer
+  std::chrono::milliseconds rto(const struct sockaddr_in& peer);
+
+ private:
+  // RFC 6298 state for one peer, in milliseconds
+  struct Estimate {
+    bool measured = false;
+    double srtt = 0;
+    double rttvar = 0;
+    double rto = 0;
+  };
+
+  // what tells requests apart: who sent it, and its header
+  struct SeenKey {
+    uint64_t peer;
+    uint32_t session;
+    uint64_t sequence;
+    MessageType type;
+
+    bool operator==(const SeenKey& rhs) const {
+      return peer == rhs.peer && session == rhs.session && sequence == rhs.sequence &&
+             type == rhs.type;
+    }
+  };
+  struct SeenKeyHash {
+    size_t operator()(const SeenKey& key) const;
+  };
+
+  // a request that came in, and what it was answered with, if anything
+  struct Seen {
+    SeenKey key;
+    std::string reply;
+  };
+
+  // a frame that came in before anybody asked for it
+  struct Early {
+    std::string datagram;
+    struct sockaddr_in from;
+  };
+
+  static uint64_t keyOf(const struct sockaddr_in& address);
+  static SeenKey keyOf(const FrameHeader& header, const struct sockaddr_in& from);
+  Estimate& estimate(const struct sockaddr_in& peer);
+  void sample(Estimate& estimate, double rtt);
+  void backOff(Estimate& estimate);
+
+  // wait up to timeout_ms (-1 forever) for a frame, copied into buffer
+  bool next(int timeout_ms, std::string& buffer, Frame& frame, struct sockaddr_in& from);
+  bool receiveRequest(const struct sockaddr_in* peer, MessageType type, uint32_t session,
+                      std::string& buffer, Frame& frame, struct sockaddr_in& from,
+                      std::chrono::milliseconds wait);
+  Seen* seen(const FrameHeader& header, const struct sockaddr_in& from);
+  void remember(const FrameHeader& header, const struct sockaddr_in& from);
+  void holdBack(const std::string& datagram, const Frame& frame, const struct sockaddr_in& from);
+
+  Server& server_;
+  TransportOptions options_;
+  uint64_t next_sequence_;
+
+  std::unordered_map<uint64_t, Estimate> estimates_;
+  // remembered requests oldest first, for eviction, and indexed for lookup.
+  // A deque never moves its elements, so the index can point into it
+  std::deque<Seen> seen_;
+  std::unordered_map<SeenKey, Seen*, SeenKeyHash> seen_index_;
+  std::deque<Early> early_;
+
+  // landing area for receives, and the frame request() sends
+  std::vector<uint8_t> scratch_;
+  std::vector<std::string> frames_;
+  std::vector<Datagram> batch_;
+};
+
+} // namespace UDP
+
+#endif // UDP_TRANSPORT_H
@@ -0,0 +1,442 @@
+#include "udp_uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+namespace UDP {
+
+namespace {
+  const unsigned kEntries = 256;
+  // provided buffers: a power of two, each big enough for the largest
+  // datagram plus the header recvmsg puts in front of it
+  const unsigned kBuffers = 64;
+  const size_t kBufferSize = sizeof(struct io_uring_recvmsg_out) +
+                             sizeof(struct sockaddr_in) + kMaxBuffer;
+  const uint16_t kBufferGroup = 0;
+  // sends in flight at once, well below kEntries
+  const size_t kSendSlots = 128;
+  // send completions carry their slot index, the receive carries this
+  const uint64_t kReceiveTag = ~0ULL;
+  // and the requests setup() probes the kernel with, these
+  const uint64_t kProbeTag = ~0ULL - 1;
+  const uint64_t kCancelTag = ~0ULL - 2;
+}
+
+// ----------------------------------------------------------------------------
+Ring* Ring::create(int sd) {
+  Ring* ring = new Ring(sd);
+  if (!ring->setup()) {
+    delete ring;
+    return NULL;
+  }
+  return ring;
+}
+
+// ----------------------------------------------------------------------------
+Ring::Ring(int sd) : sd_(sd), slots_(kSendSlots) {
+  memset(&this->receive_header_, 0, sizeof this->receive_header_);
+  this->receive_header_.msg_namelen = sizeof(struct sockaddr_in);
+
+  this->free_slots_.reserve(kSendSlots);
+  for (size_t i = 0; i < kSendSlots; ++i) {
+    this->slots_[i].busy = false;
+    this->free_slots_.push_back(&this->slots_[i]);
+  }
+}
+
+// ----------------------------------------------------------------------------
+Ring::~Ring() {
+  if (this->ring_fd_ >= 0) {
+    // take the buffers away from the kernel before they are freed
+    if (this->buffer_ring_ != NULL) {
+      struct io_uring_buf_reg reg;
+      memset(&reg, 0, sizeof reg);
+      reg.bgid = kBufferGroup;
+      syscall(__NR_io_uring_register, this->ring_fd_, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    close(this->ring_fd_);
+  }
+  if (this->buffer_ring_ != NULL)
+    munmap(this->buffer_ring_, this->buffer_ring_size_);
+  if (this->sqes_ != NULL)
+    munmap(this->sqes_, this->sqes_size_);
+  if (this->ring_memory_ != NULL)
+    munmap(this->ring_memory_, this->ring_size_);
+}
+
+// ----------------------------------------------------------------------------
+bool Ring::setup() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof params);
+  this->ring_fd_ = syscall(__NR_io_uring_setup, kEntries, &params);
+  if (this->ring_fd_ < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nio_uring_setup() failed" << std::endl;
+    return false;
+  }
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    std::cerr << "ERROR: io_uring is too old, no IORING_FEAT_SINGLE_MMAP" << std::endl;
+    return false;
+  }
+
+  // both rings live in one mapping
+  this->ring_size_ = std::max(
+      params.sq_off.array + params.sq_entries * sizeof(unsigned),
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+  void* memory = mmap(NULL, this->ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, this->ring_fd_, IORING_OFF_SQ_RING);
+  if (memory == MAP_FAILED) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nmmap() failed" << std::endl;
+    return false;
+  }
+  this->ring_memory_ = memory;
+
+  this->sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  memory = mmap(NULL, this->sqes_size_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, this->ring_fd_, IORING_OFF_SQES);
+  if (memory == MAP_FAILED) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nmmap() failed" << std::endl;
+    return false;
+  }
+  this->sqes_ = static_cast<struct io_uring_sqe*>(memory);
+
+  char* base = static_cast<char*>(this->ring_memory_);
+  this->sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+  this->sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+  this->sq_array_ = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+  this->sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+  this->sq_entries_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_entries);
+  this->cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+  this->cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+  this->cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+  this->cqes_ = reinterpret_cast<struct io_uring_cqe*>(base + params.cq_off.cqes);
+
+  // the provided buffer ring must be page aligned
+  this->buffer_ring_size_ = kBuffers * sizeof(struct io_uring_buf);
+  memory = mmap(NULL, this->buffer_ring_size_, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nmmap() failed" << std::endl;
+    return false;
+  }
+  this->buffer_ring_ = static_cast<struct io_uring_buf_ring*>(memory);
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof reg);
+  reg.ring_addr = reinterpret_cast<uint64_t>(this->buffer_ring_);
+  reg.ring_entries = kBuffers;
+  reg.bgid = kBufferGroup;
+  if (syscall(__NR_io_uring_register, this->ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nio_uring_register() failed" << std::endl;
+    munmap(this->buffer_ring_, this->buffer_ring_size_);
+    this->buffer_ring_ = NULL;
+    return false;
+  }
+
+  this->buffers_.resize(kBuffers * kBufferSize);
+  for (unsigned i = 0; i < kBuffers; ++i)
+    this->recycle(static_cast<uint16_t>(i));
+
+  if (!this->probeMultishot()) {
+    std::cerr << "ERROR: io_uring is too old, no multishot recvmsg" << std::endl;
+    return false;
+  }
+  this->armReceive();
+  return this->submit();
+}
+
+// ----------------------------------------------------------------------------
+bool Ring::probeMultishot() {
+  // IORING_REGISTER_PROBE only knows about opcodes, and recvmsg is much
+  // older than its multishot flag: 5.19 has provided buffer rings but fails
+  // every multishot recvmsg with EINVAL. So arm one on a socket nothing is
+  // sent to and cancel it; a kernel that knows the flag reports it cancelled.
+  int sd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sd < 0) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nsocket() failed" << std::endl;
+    return false;
+  }
+  struct msghdr header;
+  memset(&header, 0, sizeof header);
+
+  struct io_uring_sqe* sqe = this->nextSqe();
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = sd;
+  sqe->addr = reinterpret_cast<uint64_t>(&header);
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  sqe->user_data = kProbeTag;
+  sqe = this->nextSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = kProbeTag;
+  sqe->user_data = kCancelTag;
+
+  // both complete within the enter call, but wait for them one at a time
+  // so a signal cannot lose one
+  int result = 0;
+  bool probed = false, cancelled = false;
+  while (!probed || !cancelled) {
+    if (!this->enter(this->to_submit_, 1) && errno != EINTR)
+      break;
+    unsigned head = *this->cq_head_;
+    unsigned tail = __atomic_load_n(this->cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const struct io_uring_cqe& cqe = this->cqes_[head & this->cq_mask_];
+      if (cqe.user_data == kProbeTag && !(cqe.flags & IORING_CQE_F_MORE)) {
+        result = cqe.res;
+        probed = true;
+      } else if (cqe.user_data == kCancelTag) {
+        cancelled = true;
+      }
+    }
+    __atomic_store_n(this->cq_head_, head, __ATOMIC_RELEASE);
+  }
+  close(sd);
+  return probed && cancelled && result != -EINVAL;
+}
+
+// ----------------------------------------------------------------------------
+struct io_uring_sqe* Ring::nextSqe() {
+  unsigned tail = *this->sq_tail_;
+  if (tail - __atomic_load_n(this->sq_head_, __ATOMIC_ACQUIRE) >= this->sq_entries_) {
+    // full: the kernel copies submissions out during the enter call
+    this->submit();
+  }
+
+  // the kernel only looks at the ring inside io_uring_enter, so publishing
+  // the tail before the entry is filled in is fine
+  unsigned index = tail & this->sq_mask_;
+  this->sq_array_[index] = index;
+  __atomic_store_n(this->sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  ++this->to_submit_;
+
+  struct io_uring_sqe* sqe = &this->sqes_[index];
+  memset(sqe, 0, sizeof *sqe);
+  return sqe;
+}
+
+// ----------------------------------------------------------------------------
+bool Ring::enter(unsigned to_submit, unsigned min_complete) {
+  unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  int submitted = syscall(__NR_io_uring_enter, this->ring_fd_, to_submit, min_complete,
+                          flags, NULL, 0);
+  if (submitted < 0) {
+    if (errno != EINTR)
+      std::cerr << "ERROR: " << strerror(errno) << "\nio_uring_enter() failed" << std::endl;
+    return false;
+  }
+  this->to_submit_ -= std::min<unsigned>(submitted, this->to_submit_);
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+bool Ring::submit() {
+  if (this->to_submit_ == 0)
+    return true;
+  return this->enter(this->to_submit_, 0);
+}
+
+// ----------------------------------------------------------------------------
+void Ring::armReceive() {
+  struct io_uring_sqe* sqe = this->nextSqe();
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = this->sd_;
+  sqe->addr = reinterpret_cast<uint64_t>(&this->receive_header_);
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  sqe->user_data = kReceiveTag;
+  this->receive_armed_ = true;
+}
+
+// ----------------------------------------------------------------------------
+void Ring::reap() {
+  unsigned head = *this->cq_head_;
+  unsigned tail = __atomic_load_n(this->cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe& cqe = this->cqes_[head & this->cq_mask_];
+
+    if (cqe.user_data == kReceiveTag) {
+      if (cqe.res >= 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+        Arrival arrival;
+        arrival.buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        arrival.length = cqe.res;
+        this->arrivals_.push_back(arrival);
+      } else if (cqe.res < 0 && cqe.res != -ENOBUFS) {
+        // running out of buffers just pauses receiving until some come back
+        std::cerr << "ERROR: " << strerror(-cqe.res) << "\nrecvmsg() failed" << std::endl;
+      }
+      // the multishot request ended and has to be armed again
+      if (!(cqe.flags & IORING_CQE_F_MORE))
+        this->receive_armed_ = false;
+      continue;
+    }
+
+    SendSlot& slot = this->slots_[cqe.user_data];
+    if (cqe.res < 0) {
+      std::cerr << "ERROR: " << strerror(-cqe.res) << "\nsendmsg() failed" << std::endl;
+    }
+    slot.busy = false;
+    this->free_slots_.push_back(&slot);
+  }
+  __atomic_store_n(this->cq_head_, head, __ATOMIC_RELEASE);
+}
+
+// ----------------------------------------------------------------------------
+void Ring::recycle(uint16_t buffer_id) {
+  // not buffer_ring_->bufs: in C++ the empty struct in front of that flex
+  // array takes a byte and shifts it off the start of the ring
+  unsigned short tail = this->buffer_ring_->tail;
+  struct io_uring_buf& entry =
+      reinterpret_cast<struct io_uring_buf*>(this->buffer_ring_)[tail & (kBuffers - 1)];
+  entry.addr = reinterpret_cast<uint64_t>(this->buffers_.data() + buffer_id * kBufferSize);
+  entry.len = kBufferSize;
+  entry.bid = buffer_id;
+  __atomic_store_n(&this->buffer_ring_->tail, static_cast<unsigned short>(tail + 1),
+                   __ATOMIC_RELEASE);
+}
+
+// ----------------------------------------------------------------------------
+ssize_t Ring::deliver(const Arrival& arrival, Buffer& buffer) {
+  const uint8_t* base = this->buffers_.data() + arrival.buffer_id * kBufferSize;
+  const struct io_uring_recvmsg_out* out =
+      reinterpret_cast<const struct io_uring_recvmsg_out*>(base);
+
+  // layout: header, then room for the name and control data we asked for,
+  // then the payload
+  const uint8_t* name = base + sizeof *out;
+  const uint8_t* payload = name + this->receive_header_.msg_namelen +
+                           this->receive_header_.msg_controllen;
+  size_t available = arrival.length - (payload - base);
+  size_t length = std::min<size_t>(std::min<size_t>(out->payloadlen, available),
+                                   buffer.capacity);
+
+  memset(&buffer.address, 0, sizeof buffer.address);
+  memcpy(&buffer.address, name, std::min<size_t>(out->namelen, sizeof buffer.address));
+  memcpy(buffer.data, payload, length);
+  buffer.length = length;
+  if (out->payloadlen > buffer.capacity) {
+    std::cerr << "ERROR: datagram of " << out->payloadlen << " bytes truncated to "
+              << buffer.capacity << std::endl;
+  }
+
+  this->recycle(arrival.buffer_id);
+  return out->payloadlen;
+}
+
+// ----------------------------------------------------------------------------
+ssize_t Ring::receive(Buffer& buffer, bool wait) {
+  while (true) {
+    if (this->next_arrival_ == this->arrivals_.size()) {
+      this->arrivals_.clear();
+      this->next_arrival_ = 0;
+      this->reap();
+    }
+    if (this->next_arrival_ < this->arrivals_.size())
+      return this->deliver(this->arrivals_[this->next_arrival_++], buffer);
+
+    // nothing has arrived; the buffers are all back by now, so make sure
+    // the kernel is receiving before going to sleep
+    if (!this->receive_armed_)
+      this->armReceive();
+
+    if (!wait) {
+      this->submit();
+      this->reap();
+      if (this->arrivals_.empty()) {
+        buffer.length = 0;
+        errno = EAGAIN;
+        return -1;
+      }
+      continue;
+    }
+
+    if (!this->enter(this->to_submit_, 1) && errno != EINTR) {
+      buffer.length = 0;
+      return -1;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+int Ring::receiveBatch(Buffer* buffers, size_t count, bool wait) {
+  if (count == 0)
+    return 0;
+  if (this->receive(buffers[0], wait) < 0)
+    return -1;
+
+  // then whatever else is already there
+  size_t received = 1;
+  while (received < count) {
+    if (this->next_arrival_ == this->arrivals_.size()) {
+      this->arrivals_.clear();
+      this->next_arrival_ = 0;
+      this->reap();
+      if (this->arrivals_.empty())
+        break;
+    }
+    this->deliver(this->arrivals_[this->next_arrival_++], buffers[received++]);
+  }
+  return static_cast<int>(received);
+}
+
+// ----------------------------------------------------------------------------
+Ring::SendSlot* Ring::freeSlot() {
+  this->reap();
+  while (this->free_slots_.empty()) {
+    // everything is in flight, wait for the kernel to finish some sends
+    if (!this->enter(this->to_submit_, 1) && errno != EINTR)
+      return NULL;
+    this->reap();
+  }
+  SendSlot* slot = this->free_slots_.back();
+  this->free_slots_.pop_back();
+  return slot;
+}
+
+// ----------------------------------------------------------------------------
+bool Ring::queue(const struct sockaddr_in* destination, const void* data, size_t length) {
+  SendSlot* slot = this->freeSlot();
+  if (slot == NULL)
+    return false;
+
+  // the caller may reuse its memory as soon as we return
+  if (slot->data.size() < length)
+    slot->data.resize(length);
+  memcpy(slot->data.data(), data, length);
+  slot->vector.iov_base = slot->data.data();
+  slot->vector.iov_len = length;
+
+  memset(&slot->header, 0, sizeof slot->header);
+  if (destination != NULL) {
+    slot->address = *destination;
+    slot->header.msg_name = &slot->address;
+    slot->header.msg_namelen = sizeof slot->address;
+  }
+  slot->header.msg_iov = &slot->vector;
+  slot->header.msg_iovlen = 1;
+  slot->busy = true;
+
+  struct io_uring_sqe* sqe = this->nextSqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = this->sd_;
+  sqe->addr = reinterpret_cast<uint64_t>(&slot->header);
+  sqe->len = 1;
+  sqe->user_data = slot - this->slots_.data();
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+bool Ring::send(const struct sockaddr_in* destination, const void* data, size_t length) {
+  return this->queue(destination, data, length) && this->submit();
+}
+
+} // namespace UDP
@@ -0,0 +1,115 @@
+#ifndef UDP_URING_H
+#define UDP_URING_H
+
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <vector>
+
+#include "udp_buffer.h"
+
+namespace UDP {
+
+// io_uring engine behind a Server created with Backend::kIoUring, driven
+// through raw system calls (no liburing).
+//
+// Receiving uses one multishot recvmsg: the kernel keeps pulling datagrams
+// into a ring of provided buffers and posts a completion per datagram, so
+// there is no system call per receive while traffic keeps flowing. Each
+// datagram is copied once, from its provided buffer into the caller's,
+// and the buffer goes straight back to the kernel.
+//
+// Sends are copied into a fixed set of slots and submitted as sendmsg
+// requests: a single send costs one io_uring_enter, like sendto, and a
+// batch of any size costs one as well.
+class Ring {
+ public:
+  // Returns NULL if io_uring is unavailable (old kernel, seccomp, ...)
+  static Ring* create(int sd);
+  ~Ring();
+
+  // copying and moving not allowed
+  Ring(const Ring& rhs) = delete;
+  Ring(Ring&& rhs) = delete;
+  Ring& operator=(const Ring& rhs) = delete;
+  Ring& operator=(Ring&& rhs) = delete;
+
+  // Same contract as Server::receive(Buffer&) and receiveBatch. Without
+  // wait they fail with errno EAGAIN when nothing has arrived.
+  ssize_t receive(Buffer& buffer, bool wait);
+  int receiveBatch(Buffer* buffers, size_t count, bool wait);
+
+  // destination NULL sends on a connected socket
+  bool send(const struct sockaddr_in* destination, const void* data, size_t length);
+  // queue without submitting, submit() pushes everything queued at once
+  bool queue(const struct sockaddr_in* destination, const void* data, size_t length);
+  bool submit();
+
+ private:
+  // a datagram the kernel has delivered into a provided buffer
+  struct Arrival {
+    uint16_t buffer_id;
+    uint32_t length;
+  };
+
+  struct SendSlot {
+    std::vector<uint8_t> data;
+    struct sockaddr_in address;
+    struct msghdr header;
+    struct iovec vector;
+    bool busy;
+  };
+
+  explicit Ring(int sd);
+  bool setup();
+  // whether the kernel takes the multishot recvmsg receiving relies on
+  bool probeMultishot();
+  struct io_uring_sqe* nextSqe();
+  bool enter(unsigned to_submit, unsigned min_complete);
+  void armReceive();
+  void reap();
+  void recycle(uint16_t buffer_id);
+  ssize_t deliver(const Arrival& arrival, Buffer& buffer);
+  SendSlot* freeSlot();
+
+  int sd_;
+  int ring_fd_ = -1;
+
+  // submission and completion rings, shared with the kernel
+  void* ring_memory_ = NULL;
+  size_t ring_size_ = 0;
+  struct io_uring_sqe* sqes_ = NULL;
+  size_t sqes_size_ = 0;
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_array_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe* cqes_;
+  unsigned to_submit_ = 0;
+
+  // provided buffers for the multishot receive
+  struct io_uring_buf_ring* buffer_ring_ = NULL;
+  size_t buffer_ring_size_ = 0;
+  std::vector<uint8_t> buffers_;
+  struct msghdr receive_header_;
+  bool receive_armed_ = false;
+
+  // arrivals reaped but not handed out yet, in order
+  std::vector<Arrival> arrivals_;
+  size_t next_arrival_ = 0;
+
+  std::vector<SendSlot> slots_;
+  std::vector<SendSlot*> free_slots_;
+};
+
+} // namespace UDP
+
+#endif // UDP_URING_H
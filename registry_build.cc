@@ -0,0 +1,95 @@
+#include <errno.h>
+#include <string.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "dh_group.h"
+#include "dh_registry.h"
+
+// ----------------------------------------------------------------------------
+inline void validate_input(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Invalid Argument(s).\n";
+    std::cerr << "USAGE: " << argv[0] << " <registry-file> <principals-file>...\n"
+              << "Every line of a principals file is <name> <P> <G> [<key-hex>], P and G in"
+              << " decimal or 0x hex; blank lines and lines starting with # are skipped\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// add the principals of one text file, or say what is wrong with the first
+// line that will not do and exit
+void read_principals(const char* path, DH::RegistryBuilder& builder) {
+  std::ifstream in(path);
+  if (!in.good()) {
+    std::cerr << "ERROR: failed to open " << path << "\n";
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::string line;
+  for (int number = 1; std::getline(in, line); ++number) {
+    std::istringstream fields(line);
+    std::string name, P_text, G_text, key_text, rest;
+    if (!(fields >> name) || name[0] == '#')
+      continue;
+
+    DH::Number P, G;
+    const char* problem = NULL;
+    if (!(fields >> P_text >> G_text) || (fields >> key_text && fields >> rest))
+      problem = "expected <name> <P> <G> [<key-hex>]";
+    else if (!DH::Number::parse(P_text, P) || !DH::Number::parse(G_text, G))
+      problem = "P and G must be decimal, or hex after 0x";
+    else
+      problem = DH::Group::check(P, G);
+
+    // the key is three hex digits, like the ones typed in when prompted
+    size_t end = 0;
+    unsigned long key = 0;
+    if (problem == NULL && !key_text.empty()) {
+      try {
+        key = std::stoul(key_text, &end, 16);
+      } catch (const std::exception&) {
+      }
+      if (end != key_text.size() || key > 0xFFF)
+        problem = "the key must be at most three hex digits";
+    }
+
+    if (problem == NULL &&
+        !builder.add(name, builder.addGroup(P, G), !key_text.empty(),
+                     static_cast<uint16_t>(key)))
+      problem = name.size() > DH::kMaxPrincipalName ? "the name is too long"
+                                                     : "the name is taken already";
+    if (problem != NULL) {
+      std::cerr << "ERROR: " << path << ":" << number << ": " << problem << "\n";
+      std::exit(EXIT_FAILURE);
+    }
+  }
+}
+
+// ============================================================================
+int main(int argc, char** argv) {
+  validate_input(argc, argv);
+
+  using namespace std::chrono;
+  steady_clock::time_point start = steady_clock::now();
+  DH::RegistryBuilder builder;
+  for (int i = 2; i < argc; ++i)
+    read_principals(argv[i], builder);
+
+  if (!builder.write(argv[1])) {
+    std::cerr << "ERROR: " << strerror(errno) << "\nfailed to write " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+  }
+  double seconds = duration<double>(steady_clock::now() - start).count();
+  std::cout << "Wrote " << builder.principals() << " principals in " << builder.groups()
+            << " groups to " << argv[1] << " in " << std::fixed << std::setprecision(3)
+            << seconds << " s" << std::endl;
+  return EXIT_SUCCESS;
+}